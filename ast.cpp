@@ -1,19 +1,37 @@
 #include "ast.hpp"
 #include "parser.hpp"
 
+#include <cstdint>
+#include <limits>
+
 
 using SyntaxError = yy::parser::syntax_error;
 
 
+void ValueExpression::Fold(shared_ptr<ValueExpression>& exp)
+{
+    exp->FoldConstants();
+
+    int value;
+    if (std::dynamic_pointer_cast<ConstantExpression>(exp) == nullptr && exp->Precomputable(value))
+        exp = std::make_shared<ConstantExpression>(value, exp->location);
+    else
+        exp->folded = true;
+}
+
+
 bool UnaryValueExpression::Precomputable(int& result)
 {
+    if (folded)
+        return false;
+
     int a;
     if (exp->Precomputable(a))
     {
         if (op == "+")
             result = a;
         else if (op == "-")
-            result = -a;
+            result = int(-uint32_t(a));
         else if (op == "~")
             result = ~a;
         return true;
@@ -24,20 +42,28 @@ bool UnaryValueExpression::Precomputable(int& result)
 
 bool BinaryValueExpression::Precomputable(int& result)
 {
+    if (folded)
+        return false;
+
     int a, b;
     if (exp1->Precomputable(a) && exp2->Precomputable(b))
     {
+        // in unsigned arithmetic, which wraps around like addu, subu and mul do
         if (op == "+")
-            result = a + b;
+            result = int(uint32_t(a) + uint32_t(b));
         else if (op == "-")
-            result = a - b;
+            result = int(uint32_t(a) - uint32_t(b));
         else if (op == "*")
-            result = a * b;
-        else if (op == "/")
+            result = int(uint32_t(a) * uint32_t(b));
+        else if (op == "/" || op == "%")
         {
             if (b == 0)
                 return false;
-            result = a / b;
+            // the quotient overflows, wrap around like the hardware does
+            if (a == std::numeric_limits<int>::min() && b == -1)
+                result = op == "/" ? a : 0;
+            else
+                result = op == "/" ? a / b : a % b;
         }
         else if (op == "&")
             result = a & b;
@@ -51,6 +77,88 @@ bool BinaryValueExpression::Precomputable(int& result)
 }
 
 
+bool ValueCast::Precomputable(int& result)
+{
+    if (folded)
+        return false;
+
+    bool value;
+    if (exp->Precomputable(value))
+    {
+        result = value;
+        return true;
+    }
+    return false;
+}
+
+
+bool BooleanCast::Precomputable(bool& result)
+{
+    int value;
+    if (exp->Precomputable(value))
+    {
+        result = value != 0;
+        return true;
+    }
+    return false;
+}
+
+
+bool UnaryBooleanExpression::Precomputable(bool& result)
+{
+    bool value;
+    if (exp->Precomputable(value))
+    {
+        result = !value;
+        return true;
+    }
+    return false;
+}
+
+
+bool BinaryBooleanExpression::Precomputable(bool& result)
+{
+    // the second operand is not evaluated when the first one decides
+    bool a, b;
+    if (!exp1->Precomputable(a))
+        return false;
+    if ((op == "&&" && !a) || (op == "||" && a))
+    {
+        result = a;
+        return true;
+    }
+    if (exp2->Precomputable(b))
+    {
+        result = b;
+        return true;
+    }
+    return false;
+}
+
+
+bool RelationalExpression::Precomputable(bool& result)
+{
+    int a, b;
+    if (exp1->Precomputable(a) && exp2->Precomputable(b))
+    {
+        if (op == "==")
+            result = a == b;
+        else if (op == "!=")
+            result = a != b;
+        else if (op == "<")
+            result = a < b;
+        else if (op == "<=")
+            result = a <= b;
+        else if (op == ">")
+            result = a > b;
+        else if (op == ">=")
+            result = a >= b;
+        return true;
+    }
+    return false;
+}
+
+
 FunctionCallExpression::FunctionCallExpression(const string& name, const vector<shared_ptr<Expression>>& args, const Location& loc)
     : ValueExpression(loc), name(name)
 {
@@ -96,6 +204,16 @@ void SwitchStatement::AddStatement(shared_ptr<Statement> statement)
 }
 
 
+size_t StringLiteral::Length(const string& value)
+{
+    size_t length = 0;
+    for (size_t i = 0; i < value.size(); i++, length++)
+        if (value[i] == '\\')
+            i++;
+    return length;
+}
+
+
 FieldDefinition::FieldDefinition(const string& name, shared_ptr<SymbolType> type, shared_ptr<Expression> exp, const Location& loc)
     : Definition(loc + exp->location), name(name), type(type)
 {
@@ -108,7 +226,7 @@ FieldDefinition::FieldDefinition(const string& name, shared_ptr<SymbolType> type
     else if (is_array_type(type) && *as_array_type(type)->underlying_type == *char_type)
     {
         literal = std::dynamic_pointer_cast<StringLiteral>(exp)->value;
-        if (literal.size() + 1 > type->Width())
+        if (StringLiteral::Length(literal) + 1 > type->Width())
             throw SyntaxError(this->location, "the assigned string literal does not fit in the array");
     }
     else
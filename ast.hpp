@@ -13,6 +13,9 @@ public:
 
     virtual Code Compile(LocalContext& ctx) { return Code(); }
 
+    // replaces constant subexpressions by their values, see ValueExpression::Fold
+    virtual void FoldConstants() {}
+
     virtual string Tree(int indent = 0)
     {
         return string(indent, ' ') + "empty statement\n";
@@ -26,6 +29,10 @@ public:
     Expression(const Location& loc) : Statement(loc) {}
     
     virtual Code Compile(LocalContext& ctx) { assert(false); }
+
+    // whether evaluating the expression neither changes anything nor can fail at run time,
+    // so that it may be evaluated where the program wouldn't
+    virtual bool SideEffectFree() { return false; }
 };
 
 
@@ -45,6 +52,12 @@ public:
         return Evaluate(inner).first;
     }
     virtual std::pair<Code, shared_ptr<Symbol>> Evaluate(ExpressionContext& ctx) { assert(false); };
+
+    // folds the subexpressions of exp bottom-up and replaces exp by a ConstantExpression if it is constant
+    static void Fold(shared_ptr<ValueExpression>& exp);
+
+    // set once folded without becoming a constant, so Precomputable need not look at the subexpressions
+    bool folded = false;
 };
 
 
@@ -52,15 +65,31 @@ class BooleanExpression : public Expression
 {
 public:
     BooleanExpression(const Location& loc) : Expression(loc) {}
+
+    // whether the condition has the same truth value whenever it is evaluated, without side effects
+    // deciding it; the counterpart of ValueExpression::Precomputable
+    virtual bool Precomputable(bool& result)
+    {
+        return false;
+    }
     
     virtual Code Compile(LocalContext& ctx)
     {
         string label = ctx.global_context.NewLabel();
         ExpressionContext inner = ctx;
-        return Evaluate(inner, label, label) + (tab + label + ":\n");
+        return Evaluate(inner, label, label, label) + (tab + label + ":\n");
     }
     
-    virtual Code Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label) { assert(false); };
+    // branches to true_label or false_label; the code is followed by next_label, which is not
+    // branched to but fallen through to
+    virtual Code Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label,
+        const string& next_label) { assert(false); };
+
+    // whether EvaluateValue can compute the truth value without branches
+    virtual bool BranchFree() { return false; }
+
+    // the truth value, or its negation, as 0 or 1 in a new temporary
+    virtual std::pair<Code, shared_ptr<Symbol>> EvaluateValue(ExpressionContext& ctx, bool negated) { assert(false); };
 };
 
 
@@ -71,9 +100,15 @@ public:
         : ValueExpression(exp->location), exp(exp) {}
     
     shared_ptr<BooleanExpression> exp;
+
+    virtual bool Precomputable(int& result);
     
     virtual std::pair<Code, shared_ptr<Symbol>> Evaluate(ExpressionContext& ctx);
 
+    virtual bool SideEffectFree() { return exp->SideEffectFree(); }
+
+    virtual void FoldConstants() { exp->FoldConstants(); }
+
     static shared_ptr<ValueExpression> IfNeeded(shared_ptr<Expression> exp)
     {
         if (auto value = std::dynamic_pointer_cast<ValueExpression>(exp))
@@ -97,8 +132,18 @@ public:
         : BooleanExpression(exp->location), exp(exp) {}
     
     shared_ptr<ValueExpression> exp;
+
+    virtual bool Precomputable(bool& result);
     
-    virtual Code Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label);
+    virtual Code Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label,
+        const string& next_label);
+
+    virtual bool BranchFree() { return true; }
+    virtual std::pair<Code, shared_ptr<Symbol>> EvaluateValue(ExpressionContext& ctx, bool negated);
+
+    virtual bool SideEffectFree() { return exp->SideEffectFree(); }
+
+    virtual void FoldConstants() { ValueExpression::Fold(exp); }
 
     static shared_ptr<BooleanExpression> IfNeeded(shared_ptr<Expression> exp)
     {
@@ -133,6 +178,10 @@ public:
     
     virtual std::pair<Code, shared_ptr<Symbol>> Evaluate(ExpressionContext& ctx);
 
+    virtual bool SideEffectFree() { return exp->SideEffectFree(); }
+
+    virtual void FoldConstants() { Fold(exp); }
+
     virtual string Tree(int indent = 0)
     {
         return string(indent, ' ') + "unary operator " + op + "\n" + exp->Tree(indent + indent_length);
@@ -151,7 +200,7 @@ public:
         : ValueExpression(exp1->location + exp2->location),
         exp1(ValueCast::IfNeeded(exp1)), exp2(ValueCast::IfNeeded(exp2)), op(op)
     {
-        if (op != "+" && op != "-" && op != "*" && op != "/" && op != "&" && op != "|" && op != "^")
+        if (op != "+" && op != "-" && op != "*" && op != "/" && op != "%" && op != "&" && op != "|" && op != "^")
             throw std::domain_error("invalid operator");
     }
 
@@ -162,6 +211,21 @@ public:
     
     virtual std::pair<Code, shared_ptr<Symbol>> Evaluate(ExpressionContext& ctx);
 
+    virtual bool SideEffectFree()
+    {
+        // dividing by zero traps
+        int divisor;
+        if ((op == "/" || op == "%") && !(exp2->Precomputable(divisor) && divisor != 0))
+            return false;
+        return exp1->SideEffectFree() && exp2->SideEffectFree();
+    }
+
+    virtual void FoldConstants()
+    {
+        Fold(exp1);
+        Fold(exp2);
+    }
+
     virtual string Tree(int indent = 0)
     {
         return string(indent, ' ') + "binary operator " + op + "\n" +
@@ -170,7 +234,7 @@ public:
 
 private:
     static inline const map<string, string> op_to_instruction = 
-        {{"+", "addu"}, {"-", "subu"}, {"*", "mul"}, {"/", "divu"}, {"&", "and"}, {"|", "or"}, {"^", "xor"}};;
+        {{"+", "addu"}, {"-", "subu"}, {"*", "mul"}, {"/", "div"}, {"%", "rem"}, {"&", "and"}, {"|", "or"}, {"^", "xor"}};;
 };
 
 
@@ -190,6 +254,8 @@ public:
 
     virtual std::pair<Code, shared_ptr<Symbol>> Evaluate(ExpressionContext& ctx);
 
+    virtual bool SideEffectFree() { return true; }
+
     virtual string Tree(int indent = 0)
     {
         return string(indent, ' ') + std::to_string(value) + "\n";
@@ -204,6 +270,9 @@ public:
         : Expression(loc), value(value) {}
 
     string value;
+
+    // the number of characters of a value once the assembler has replaced its escape sequences
+    static size_t Length(const string& value);
     
     virtual bool Precomputable(int& result)
     {
@@ -240,6 +309,8 @@ public:
     string name;
     
     virtual std::pair<Code, shared_ptr<Symbol>> Evaluate(ExpressionContext& ctx);
+
+    virtual bool SideEffectFree() { return true; }
     
     virtual Code Assign(ExpressionContext& ctx, shared_ptr<Symbol> value)
     {
@@ -247,8 +318,8 @@ public:
         if (!symbol)
             throw CompileError(location, "undefined symbol \"" + name + "\"");
 
-        Code code = value->LoadValue("$v0");
-        code += symbol->SaveValue("$v0");
+        auto [code, reg] = ctx.ValueRegister(value);
+        code += symbol->SaveValue(reg);
         return code;
     }
 
@@ -272,9 +343,11 @@ public:
     
     virtual Code Assign(ExpressionContext& ctx, shared_ptr<Symbol> value);
 
+    virtual void FoldConstants() { Fold(index); }
+
 private:
     Code EnsureIndexInRange(ExpressionContext& ctx,
-        shared_ptr<Symbol> array_symbol, shared_ptr<Symbol> index_symbol);
+        shared_ptr<Symbol> array_symbol, const string& index_reg);
 
 public:
     virtual string Tree(int indent = 0)
@@ -295,6 +368,12 @@ public:
     
     virtual std::pair<Code, shared_ptr<Symbol>> Evaluate(ExpressionContext& ctx);
 
+    virtual void FoldConstants()
+    {
+        left->FoldConstants();
+        Fold(exp);
+    }
+
     virtual string Tree(int indent = 0)
     {
         return string(indent, ' ') + "assignment =\n" +
@@ -313,6 +392,39 @@ public:
     
     virtual std::pair<Code, shared_ptr<Symbol>> Evaluate(ExpressionContext& ctx);
 
+    // evaluates the call as the value returned by the function it is in: a call to the function
+    // itself becomes a jump back to the start of its body and a call to another function a jump
+    // to it once the frame is torn down, the symbol is null when that is the case
+    std::pair<Code, shared_ptr<Symbol>> EvaluateTail(ExpressionContext& ctx);
+
+private:
+    shared_ptr<FunctionSymbol> Function(ExpressionContext& ctx);
+
+    std::pair<Code, vector<shared_ptr<Symbol>>> EvaluateArguments(ExpressionContext& ctx,
+        const FunctionSymbol& function_symbol);
+
+    // loads the value of argument i, evaluated to symbol, into reg as a parameter of the given type
+    Code LoadArgument(size_t i, shared_ptr<Symbol> symbol, shared_ptr<SymbolType> type, const string& reg);
+
+    // calls the function with the evaluated arguments, code evaluating them comes first
+    std::pair<Code, shared_ptr<Symbol>> Call(ExpressionContext& ctx, const FunctionSymbol& function_symbol,
+        Code code, const vector<shared_ptr<Symbol>>& symbols);
+
+    // the definition to compile in place of the call, null if the function is to be called
+    FunctionDefinition* InlinedDefinition(ExpressionContext& ctx);
+
+    // compiles the body of definition in place of the call, with the evaluated arguments
+    std::pair<Code, shared_ptr<Symbol>> Inline(ExpressionContext& ctx, FunctionDefinition& definition,
+        const vector<shared_ptr<Symbol>>& symbols);
+
+public:
+
+    virtual void FoldConstants()
+    {
+        for (auto& a : args)
+            Fold(a);
+    }
+
     virtual string Tree(int indent = 0)
     {
         string str = string(indent, ' ') + "call " + name + "\n";
@@ -336,8 +448,21 @@ public:
 
     shared_ptr<BooleanExpression> exp;
     string op;
+
+    virtual bool Precomputable(bool& result);
     
-    virtual Code Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label);
+    virtual Code Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label,
+        const string& next_label);
+
+    virtual bool BranchFree() { return exp->BranchFree(); }
+    virtual std::pair<Code, shared_ptr<Symbol>> EvaluateValue(ExpressionContext& ctx, bool negated)
+    {
+        return exp->EvaluateValue(ctx, !negated);
+    }
+
+    virtual bool SideEffectFree() { return exp->SideEffectFree(); }
+
+    virtual void FoldConstants() { exp->FoldConstants(); }
 
     virtual string Tree(int indent = 0)
     {
@@ -359,8 +484,23 @@ public:
 
     shared_ptr<BooleanExpression> exp1, exp2;
     string op;
+
+    virtual bool Precomputable(bool& result);
     
-    virtual Code Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label);
+    virtual Code Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label,
+        const string& next_label);
+
+    // the second operand is evaluated even when the first one decides
+    virtual bool BranchFree() { return exp1->BranchFree() && exp2->BranchFree() && exp2->SideEffectFree(); }
+    virtual std::pair<Code, shared_ptr<Symbol>> EvaluateValue(ExpressionContext& ctx, bool negated);
+
+    virtual bool SideEffectFree() { return exp1->SideEffectFree() && exp2->SideEffectFree(); }
+
+    virtual void FoldConstants()
+    {
+        exp1->FoldConstants();
+        exp2->FoldConstants();
+    }
 
     virtual string Tree(int indent = 0)
     {
@@ -383,8 +523,22 @@ public:
 
     shared_ptr<ValueExpression> exp1, exp2;
     string op;
+
+    virtual bool Precomputable(bool& result);
     
-    virtual Code Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label);
+    virtual Code Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label,
+        const string& next_label);
+
+    virtual bool BranchFree() { return true; }
+    virtual std::pair<Code, shared_ptr<Symbol>> EvaluateValue(ExpressionContext& ctx, bool negated);
+
+    virtual bool SideEffectFree() { return exp1->SideEffectFree() && exp2->SideEffectFree(); }
+
+    virtual void FoldConstants()
+    {
+        ValueExpression::Fold(exp1);
+        ValueExpression::Fold(exp2);
+    }
 
     virtual string Tree(int indent = 0)
     {
@@ -395,6 +549,18 @@ public:
 private:
     static inline const map<string, string> op_to_instruction = 
         {{"==", "beq"}, {"!=", "bne"}, {">", "bgt"}, {">=", "bge"}, {"<", "blt"}, {"<=", "ble"}};;
+
+    // the operator to use when the operands are swapped
+    static inline const map<string, string> swapped_op = 
+        {{"==", "=="}, {"!=", "!="}, {">", "<"}, {">=", "<="}, {"<", ">"}, {"<=", ">="}};
+
+    // the operator testing the opposite
+    static inline const map<string, string> negated_op = 
+        {{"==", "!="}, {"!=", "=="}, {">", "<="}, {">=", "<"}, {"<", ">="}, {"<=", ">"}};
+
+    // branches comparing with zero
+    static inline const map<string, string> zero_op_to_instruction = 
+        {{"==", "beqz"}, {"!=", "bnez"}, {">", "bgtz"}, {">=", "bgez"}, {"<", "bltz"}, {"<=", "blez"}};
 };
 
 
@@ -463,6 +629,12 @@ public:
 
     virtual Code Compile(LocalContext& ctx);
 
+    virtual void FoldConstants()
+    {
+        if (exp != nullptr)
+            ValueExpression::Fold(exp);
+    }
+
     virtual string Tree(int indent = 0)
     {
         return string(indent, ' ') + "return\n" +
@@ -498,15 +670,15 @@ public:
         return CompileOnContext(ctx);
     }
 
-private:
-    Code CompileOnContext(LocalContext& ctx)
+    virtual void FoldConstants()
     {
-        Code code;
         for (auto s : statements)
-            code += s->Compile(ctx);
-        return code;
+            s->FoldConstants();
     }
 
+private:
+    Code CompileOnContext(LocalContext& ctx);
+
 public:
     virtual string Tree(int indent = 0)
     {
@@ -531,6 +703,13 @@ public:
 
     virtual Code Compile(LocalContext& ctx);
 
+    virtual void FoldConstants()
+    {
+        condition->FoldConstants();
+        then_block->FoldConstants();
+        else_block->FoldConstants();
+    }
+
     virtual string Tree(int indent = 0)
     {
         string str = string(indent, ' ') + "if\n";
@@ -567,6 +746,26 @@ public:
     
     virtual Code Compile(LocalContext& parent_ctx);
 
+    virtual void FoldConstants()
+    {
+        ValueExpression::Fold(exp);
+        for (auto& body : case_bodies)
+            for (auto s : body)
+                s->FoldConstants();
+    }
+
+private:
+    // fewer cases than this are compared one by one
+    static const size_t linear_cases = 4;
+
+    // a jump table is used when at least one in this many of its entries is a case
+    static const size_t jump_table_density = 3;
+
+    // binary search over the cases in [begin, end), which are (value, index) pairs sorted by value
+    Code Dispatch(LocalContext& ctx, const string& reg, const vector<std::pair<int, size_t>>& cases,
+        size_t begin, size_t end, const string& case_label, const string& default_label);
+
+public:
     virtual string Tree(int indent = 0)
     {
         string str = string(indent, ' ') + "switch\n";
@@ -595,6 +794,12 @@ public:
 
     virtual Code Compile(LocalContext& ctx);
 
+    virtual void FoldConstants()
+    {
+        condition->FoldConstants();
+        body->FoldConstants();
+    }
+
     virtual string Tree(int indent = 0)
     {
         string str = string(indent, ' ') + "while\n";
@@ -623,6 +828,15 @@ public:
 
     virtual Code Compile(LocalContext& parent_ctx);
 
+    virtual void FoldConstants()
+    {
+        for (auto i : initializer)
+            i->FoldConstants();
+        condition->FoldConstants();
+        step->FoldConstants();
+        body->FoldConstants();
+    }
+
     virtual string Tree(int indent = 0)
     {
         string str = string(indent, ' ') + "for\n";
@@ -637,6 +851,12 @@ public:
         str += body->Tree(indent + 2 * indent_length);
         return str;
     }
+
+private:
+    // compiles the loop running several copies of the body for each test when it counts a local
+    // variable up or down to a bound; body_code and step_code are the first copy, compiled with
+    // continue branching to the step label, and code is left alone when the loop isn't unrolled
+    bool Unroll(LocalContext& ctx, const string& label, const Code& body_code, const Code& step_code, Code& code);
 };
 
 
@@ -650,6 +870,8 @@ public:
 
     virtual Code Compile(GlobalContext&) = 0;
 
+    virtual void FoldConstants() {}
+
     virtual string Tree(int indent = 0) = 0;
 };
 
@@ -699,6 +921,8 @@ public:
     
     virtual Code Compile(GlobalContext& ctx);
 
+    virtual void FoldConstants() { body->FoldConstants(); }
+
     virtual string Tree(int indent = 0)
     {
         string str = string(indent, ' ') + "function " + name + " : " + type->Name() + "\n";
@@ -733,7 +957,8 @@ public:
 
     vector<shared_ptr<Definition>> definitions;
 
-    Code Compile(function<void(const Location&, const string&, const string&)> printer);
+    Code Compile(function<void(const Location&, const string&, const string&)> printer,
+        const CompileOptions& options = CompileOptions());
 
     virtual string Tree(int indent = 0)
     {
@@ -745,7 +970,6 @@ public:
 
 private:
     static inline string builtin_filename = "builtin";
-    static inline const string& builtin_asm_filename = "builtins.asm";
 };
 
 
@@ -0,0 +1,510 @@
+#include "optimizer.hpp"
+
+#include <algorithm>
+#include <climits>
+
+
+// the routine array bounds checks branch to, see ArrayAccessExpression::EnsureIndexInRange
+static const string bounds_error = "$out_of_bounds_error";
+
+static bool is_bounds_check(const Instruction& instruction)
+{
+    return instruction.op == "bgeu" && instruction.Target() == bounds_error;
+}
+
+// a loop whose header compares a counter stepping by a constant against a loop invariant bound,
+//     header:  phi counter, init, counter + step ...
+//              b<op> counter, bound, body
+// so that in the blocks dominated by body the counter lies between init and the bound
+struct CountedLoop
+{
+    const Loop* loop;
+    size_t preheader;  // the only predecessor outside the loop, blocks.size() if there are several
+    size_t body;       // the successor of the header inside the loop
+    string counter, init, bound;
+    int step;
+    bool inclusive;    // the bound is reached, <= or >= rather than < or >
+};
+
+class BoundsCheckEliminator
+{
+public:
+    BoundsCheckEliminator(FunctionBody& body) : body(body)
+    {
+        idom = body.ComputeDominators();
+        loops = body.FindLoops(idom);
+
+        for (size_t b = 0; b < body.blocks.size(); b++)
+            for (size_t i = 0; i < body.blocks[b].instructions.size(); i++)
+                for (auto& reg : body.blocks[b].instructions[i].Defs())
+                    if (is_virtual_register(reg))
+                        definitions[reg] = std::make_pair(b, i);
+
+        for (auto& loop : loops)
+        {
+            CountedLoop counted;
+            if (FindCounter(loop, counted))
+                counted_loops[loop.header] = counted;
+        }
+    }
+
+    void Run();
+
+private:
+    FunctionBody& body;
+    vector<size_t> idom;
+    vector<Loop> loops;
+    map<string, std::pair<size_t, size_t>> definitions;  // block and index of the instruction
+    map<size_t, CountedLoop> counted_loops;              // by header
+
+    const Instruction* Definition(const string& reg) const
+    {
+        auto it = definitions.find(reg);
+        if (it == definitions.end())
+            return nullptr;
+        return &body.blocks[it->second.first].instructions[it->second.second];
+    }
+
+    // follows copies back to the register holding the value
+    string Resolve(const string& reg) const
+    {
+        auto instruction = Definition(reg);
+        if (instruction != nullptr && instruction->op == "move" && is_virtual_register(instruction->operands[1]))
+            return Resolve(instruction->operands[1]);
+        return reg;
+    }
+
+    bool Constant(const string& operand, long long& value) const;
+    bool Invariant(const Loop& loop, const string& operand) const;
+    bool FindCounter(const Loop& loop, CountedLoop& counted) const;
+
+    // bounds of the values operand can hold in the given block
+    bool Range(const string& operand, size_t block, long long& lo, long long& hi) const;
+    bool Range(const string& operand, size_t block, long long& lo, long long& hi, set<string>& visiting) const;
+
+    // operand as scale * counter + offset
+    bool Linear(const string& operand, const string& counter, long long& scale, long long& offset) const;
+
+    bool Hoistable(const CountedLoop& counted, size_t block) const;
+};
+
+bool BoundsCheckEliminator::Constant(const string& operand, long long& value) const
+{
+    if (operand == "$zero")
+        value = 0;
+    else if (!is_register(operand))
+        value = std::stoll(operand, nullptr, 0);
+    else
+    {
+        auto instruction = Definition(operand);
+        if (instruction == nullptr || instruction->op != "li")
+            return false;
+        value = std::stoll(instruction->operands[1], nullptr, 0);
+    }
+    return true;
+}
+
+bool BoundsCheckEliminator::Invariant(const Loop& loop, const string& operand) const
+{
+    if (!is_register(operand) || operand == "$zero")
+        return true;
+    auto it = definitions.find(operand);
+    return is_virtual_register(operand) && it != definitions.end() && loop.blocks.count(it->second.first) == 0;
+}
+
+bool BoundsCheckEliminator::FindCounter(const Loop& loop, CountedLoop& counted) const
+{
+    auto& header = body.blocks[loop.header];
+    if (header.instructions.empty())
+        return false;
+
+    // the header test and the successor it leads to inside the loop
+    Instruction test = header.instructions.back();
+    static const map<string, string> against_zero = {{"bltz", "blt"}, {"blez", "ble"}, {"bgtz", "bgt"}, {"bgez", "bge"}};
+    if (against_zero.count(test.op) > 0 && test.operands.size() == 2)
+        test = Instruction(against_zero.at(test.op), {test.operands[0], "$zero", test.operands[1]});
+    static const map<string, string> negated = {{"blt", "bge"}, {"ble", "bgt"}, {"bgt", "ble"}, {"bge", "blt"}};
+    static const map<string, string> swapped = {{"blt", "bgt"}, {"ble", "bge"}, {"bgt", "blt"}, {"bge", "ble"}};
+    if (negated.count(test.op) == 0 || test.operands.size() != 3)
+        return false;
+
+    size_t taken = body.FindBlock(test.Target()), next = loop.header + 1;
+    if (loop.blocks.count(taken) > 0 && loop.blocks.count(next) == 0)
+        counted.body = taken;
+    else if (loop.blocks.count(taken) == 0 && loop.blocks.count(next) > 0 && taken < body.blocks.size())
+    {
+        counted.body = next;
+        test.op = negated.at(test.op);
+    }
+    else
+        return false;
+
+    auto& predecessors = body.blocks[counted.body].predecessors;
+    if (predecessors.size() != 1 || predecessors[0] != loop.header)
+        return false;
+
+    // the counter is a phi of the header
+    auto is_phi = [&](const string& operand)
+    {
+        auto it = definitions.find(Resolve(operand));
+        return it != definitions.end() && it->second.first == loop.header &&
+            body.blocks[loop.header].instructions[it->second.second].IsPhi();
+    };
+    if (!is_phi(test.operands[0]))
+    {
+        std::swap(test.operands[0], test.operands[1]);
+        test.op = swapped.at(test.op);
+    }
+    if (!is_phi(test.operands[0]) || !Invariant(loop, test.operands[1]))
+        return false;
+
+    counted.loop = &loop;
+    counted.counter = Resolve(test.operands[0]);
+    counted.bound = test.operands[1];
+    counted.inclusive = test.op == "ble" || test.op == "bge";
+
+    // one initial value from outside the loop and the same constant step along every latch
+    auto& phi = *Definition(counted.counter);
+    vector<size_t> outside;
+    bool stepped = false;
+    for (size_t j = 1; j < phi.operands.size(); j++)
+    {
+        size_t p = header.predecessors[j - 1];
+        if (loop.blocks.count(p) == 0)
+        {
+            if (!counted.init.empty() && counted.init != phi.operands[j])
+                return false;
+            counted.init = phi.operands[j];
+            outside.push_back(p);
+            continue;
+        }
+
+        // the latch adds constants to the counter, once or in several steps for an unrolled loop
+        long long scale, step;
+        if (!Linear(phi.operands[j], counted.counter, scale, step) || scale != 1)
+            return false;
+        if (step == 0 || (stepped && step != counted.step))
+            return false;
+        counted.step = int(step);
+        stepped = true;
+    }
+    counted.preheader = outside.size() == 1 ? outside[0] : body.blocks.size();
+
+    // the step goes towards the bound
+    bool upwards = test.op == "blt" || test.op == "ble";
+    return !counted.init.empty() && stepped && (counted.step > 0) == upwards;
+}
+
+bool BoundsCheckEliminator::Range(const string& operand, size_t block, long long& lo, long long& hi) const
+{
+    set<string> visiting;
+    return Range(operand, block, lo, hi, visiting);
+}
+
+bool BoundsCheckEliminator::Range(const string& operand, size_t block, long long& lo, long long& hi,
+    set<string>& visiting) const
+{
+    long long value;
+    if (Constant(operand, value))
+    {
+        lo = hi = value;
+        return true;
+    }
+
+    auto instruction = Definition(operand);
+    if (instruction == nullptr || !visiting.insert(operand).second)
+        return false;
+    auto& op = instruction->op;
+    auto& ops = instruction->operands;
+
+    long long alo, ahi, blo, bhi;
+    auto range = [&](size_t k, long long& l, long long& h)
+    {
+        return k < ops.size() && Range(ops[k], block, l, h, visiting);
+    };
+
+    bool known = false;
+    if (op == "move")
+        known = range(1, lo, hi);
+    else if ((op == "addu" || op == "addiu") && range(1, alo, ahi) && range(2, blo, bhi))
+    {
+        lo = alo + blo;
+        hi = ahi + bhi;
+        known = true;
+    }
+    else if (op == "subu" && range(1, alo, ahi) && range(2, blo, bhi))
+    {
+        lo = alo - bhi;
+        hi = ahi - blo;
+        known = true;
+    }
+    else if (op == "negu" && range(1, alo, ahi))
+    {
+        lo = -ahi;
+        hi = -alo;
+        known = true;
+    }
+    else if ((op == "mul" || op == "sll") && range(1, alo, ahi) && range(2, blo, bhi))
+    {
+        if (op == "sll")
+        {
+            if (blo != bhi || blo < 0 || blo > 31)
+                return false;
+            blo = bhi = 1LL << blo;
+        }
+        auto products = {alo * blo, alo * bhi, ahi * blo, ahi * bhi};
+        lo = std::min(products);
+        hi = std::max(products);
+        known = true;
+    }
+    else if ((op == "sra" || op == "srl") && range(1, alo, ahi) && Constant(ops[2], value) && value > 0 && value < 32)
+    {
+        if (op == "sra" || alo >= 0)
+        {
+            lo = alo >> value;
+            hi = ahi >> value;
+        }
+        else
+        {
+            lo = 0;
+            hi = 0xffffffffLL >> value;
+        }
+        known = true;
+    }
+    else if ((op == "and" || op == "andi") && Constant(ops[2], value) && value >= 0)
+    {
+        lo = 0;
+        hi = value;
+        known = true;
+    }
+    else if (op == "lbu" || op == "lb")
+    {
+        lo = op == "lbu" ? 0 : -128;
+        hi = op == "lbu" ? 255 : 127;
+        known = true;
+    }
+    else if (op == "slt" || op == "sltu" || op == "slti" || op == "sltiu")
+    {
+        lo = 0;
+        hi = 1;
+        known = true;
+    }
+    else if (instruction->IsPhi())
+    {
+        // a loop counter seen after the header test, it can't overflow as the step from its
+        // last tested value still fits
+        auto it = counted_loops.find(definitions.at(operand).first);
+        if (it != counted_loops.end() && it->second.counter == operand &&
+            FunctionBody::Dominates(idom, it->second.body, block))
+        {
+            auto& counted = it->second;
+            long long ilo, ihi;
+            if (Range(counted.init, block, ilo, ihi, visiting) && Range(counted.bound, block, blo, bhi, visiting))
+            {
+                if (counted.step > 0)
+                {
+                    lo = ilo;
+                    hi = counted.inclusive ? bhi : bhi - 1;
+                    known = hi + counted.step <= INT_MAX;
+                }
+                else
+                {
+                    lo = counted.inclusive ? blo : blo + 1;
+                    hi = ihi;
+                    known = lo + counted.step >= INT_MIN;
+                }
+            }
+        }
+        else
+        {
+            // otherwise any of the incoming values
+            known = true;
+            lo = LLONG_MAX;
+            hi = LLONG_MIN;
+            for (size_t j = 1; j < ops.size() && known; j++)
+            {
+                known = range(j, alo, ahi);
+                lo = std::min(lo, alo);
+                hi = std::max(hi, ahi);
+            }
+        }
+    }
+
+    visiting.erase(operand);
+
+    // a result that may wrap around is not known
+    return known && lo >= INT_MIN && hi <= INT_MAX;
+}
+
+bool BoundsCheckEliminator::Linear(const string& operand, const string& counter,
+    long long& scale, long long& offset) const
+{
+    if (operand == counter)
+    {
+        scale = 1;
+        offset = 0;
+        return true;
+    }
+
+    auto instruction = Definition(operand);
+    if (instruction == nullptr)
+        return false;
+    auto& op = instruction->op;
+    auto& ops = instruction->operands;
+
+    long long value;
+    if (op == "move")
+        return Linear(ops[1], counter, scale, offset);
+    if ((op == "addu" || op == "addiu") && Constant(ops[2], value) && Linear(ops[1], counter, scale, offset))
+        offset += value;
+    else if (op == "addu" && Constant(ops[1], value) && Linear(ops[2], counter, scale, offset))
+        offset += value;
+    else if (op == "subu" && Constant(ops[2], value) && Linear(ops[1], counter, scale, offset))
+        offset -= value;
+    else if (op == "sll" && Constant(ops[2], value) && value >= 0 && value < 31 &&
+        Linear(ops[1], counter, scale, offset))
+    {
+        scale <<= value;
+        offset <<= value;
+    }
+    else if (op == "mul" && Constant(ops[2], value) && value > 0 && Linear(ops[1], counter, scale, offset))
+    {
+        scale *= value;
+        offset *= value;
+    }
+    else
+        return false;
+    return scale < INT_MAX && offset > INT_MIN && offset < INT_MAX;
+}
+
+bool BoundsCheckEliminator::Hoistable(const CountedLoop& counted, size_t block) const
+{
+    auto& loop = *counted.loop;
+    if (counted.step != 1 || counted.preheader != loop.header - 1 ||
+        (!body.blocks[counted.preheader].instructions.empty() &&
+            body.blocks[counted.preheader].instructions.back().IsTerminator()))
+        return false;
+
+    // the check runs in every iteration
+    for (auto latch : loop.latches)
+        if (!FunctionBody::Dominates(idom, block, latch))
+            return false;
+
+    // the loop runs until the counter reaches the bound, without output, inner loops or any
+    // other way out; failing before the first iteration instead of in the middle can't be told
+    // apart then
+    static const set<string> traps = {"syscall", "break", "teq", "tne", "tge", "tgeu", "tlt", "tltu"};
+    for (auto b : loop.blocks)
+    {
+        if (b == loop.header)
+            continue;
+        if (std::any_of(loops.begin(), loops.end(), [b](const Loop& l) { return l.header == b; }))
+            return false;
+        for (auto s : body.blocks[b].successors)
+            if (loop.blocks.count(s) == 0)
+                return false;
+
+        for (auto& instruction : body.blocks[b].instructions)
+        {
+            long long divisor;
+            if (instruction.IsCall() || instruction.IsReturn() || instruction.IsIndirectJump() ||
+                traps.count(instruction.op) > 0)
+                return false;
+            if ((instruction.op == "div" || instruction.op == "divu" || instruction.op == "rem" ||
+                    instruction.op == "remu") &&
+                (instruction.operands.size() != 3 || !Constant(instruction.operands[2], divisor) || divisor == 0))
+                return false;
+            if (instruction.IsTerminator() && body.FindBlock(instruction.Target()) == body.blocks.size() &&
+                !is_bounds_check(instruction))
+                return false;
+        }
+    }
+    return true;
+}
+
+void BoundsCheckEliminator::Run()
+{
+    set<size_t> removed;                          // blocks whose check goes away
+    map<size_t, map<string, long long>> hoisted;  // preheader -> bound -> highest bound passing
+
+    for (size_t b = 0; b < body.blocks.size(); b++)
+    {
+        auto& instructions = body.blocks[b].instructions;
+        if (instructions.empty() || !is_bounds_check(instructions.back()))
+            continue;
+        auto& index = instructions.back().operands[0];
+        long long size = std::stoll(instructions.back().operands[1], nullptr, 0);
+
+        // the index is known to be in range
+        long long lo, hi;
+        if (Range(index, b, lo, hi) && lo >= 0 && hi < size)
+        {
+            removed.insert(b);
+            continue;
+        }
+
+        // a dominating check of the same index against no larger size already passed
+        bool checked = false;
+        for (size_t d = b; d != 0 && !checked;)
+        {
+            d = idom[d];
+            auto& dominating = body.blocks[d].instructions;
+            checked = !dominating.empty() && is_bounds_check(dominating.back()) &&
+                dominating.back().operands[0] == index &&
+                std::stoll(dominating.back().operands[1], nullptr, 0) <= size;
+        }
+        if (checked)
+        {
+            removed.insert(b);
+            continue;
+        }
+
+        // an index going up with the counter of the innermost loop is checked once for the
+        // last iteration in front of the loop: the highest counter value in range is limit,
+        // so the loop must stop at limit + 1 at the latest, which also holds when it doesn't run
+        auto loop = std::find_if(loops.begin(), loops.end(), [b](const Loop& l) { return l.blocks.count(b) > 0; });
+        if (loop == loops.end() || counted_loops.count(loop->header) == 0)
+            continue;
+        auto& counted = counted_loops.at(loop->header);
+
+        long long scale, offset, ilo, ihi;
+        if (!is_register(counted.bound) || !Hoistable(counted, b) ||
+            !Linear(index, counted.counter, scale, offset) || scale <= 0 ||
+            !Range(counted.init, counted.preheader, ilo, ihi) || size - 1 - offset < 0)
+            continue;
+
+        long long limit = (size - 1 - offset) / scale;
+        if (scale * ilo + offset < 0 || ihi > limit + 1)
+            continue;
+
+        long long highest = counted.inclusive ? limit : limit + 1;
+        if (highest < INT_MAX)
+        {
+            auto& bounds = hoisted[counted.preheader];
+            bounds[counted.bound] = bounds.count(counted.bound) > 0 ? std::min(bounds[counted.bound], highest) : highest;
+        }
+        removed.insert(b);
+    }
+
+    for (auto b : removed)
+        body.blocks[b].instructions.pop_back();
+
+    // each hoisted check ends a new block between the preheader and the loop header
+    for (auto it = hoisted.rbegin(); it != hoisted.rend(); ++it)
+        for (auto& [bound, highest] : it->second)
+        {
+            BasicBlock block;
+            Instruction check("bgt", {bound, std::to_string(highest), bounds_error});
+            check.comment = "array index bounds check for the whole loop";
+            block.instructions.push_back(check);
+            body.blocks.insert(body.blocks.begin() + it->first + 1, block);
+        }
+
+    body.BuildControlFlowGraph();
+}
+
+
+void EliminateBoundsChecks(FunctionBody& body)
+{
+    BoundsCheckEliminator(body).Run();
+}
@@ -1,48 +1,158 @@
 #include "ast.hpp"
+#include "regalloc.hpp"
+#include "optimizer.hpp"
+#include "frame.hpp"
+#include "runtime.hpp"
 
-#include <fstream>
+#include <algorithm>
+#include <climits>
 #include <sstream>
 
 
+// evaluates the second operand of an instruction; constants are not loaded into a register
+// but returned as an immediate operand
+static std::pair<Code, string> EvaluateOperand(ExpressionContext& ctx, shared_ptr<ValueExpression> exp)
+{
+    if (auto constant = std::dynamic_pointer_cast<ConstantExpression>(exp))
+        return std::make_pair(Code(), constant->value == 0 ? "$zero" : std::to_string(constant->value));
+
+    auto [code, symbol] = exp->Evaluate(ctx);
+    auto [load_code, reg] = ctx.ValueRegister(symbol);
+    return std::make_pair(code + load_code, reg);
+}
+
+
+// a branch to label unless it is the next label anyway
+static Code BranchTo(const string& label, const string& next_label)
+{
+    if (label == next_label)
+        return Code();
+    return tab + "b " + label + "\n";
+}
+
+
+// compiles code that is never reached for the errors it may raise and drops it, undoing what
+// it would tell about the function
+static void CheckUnreachable(LocalContext& ctx, const function<Code()>& compile)
+{
+    auto& global = ctx.global_context;
+    size_t report_size = global.inline_report.size();
+    bool tail_recursive = ctx.function_context.tail_recursive;
+
+    compile();
+
+    global.inline_report.resize(report_size);
+    ctx.function_context.tail_recursive = tail_recursive;
+}
+
+
+// the instructions of a piece of function code, without labels, directives and comments
+static vector<Instruction> Instructions(const Code& code)
+{
+    std::stringstream text;
+    text << code;
+
+    vector<Instruction> instructions;
+    string line;
+    while (std::getline(text, line))
+    {
+        line = trim(line);
+        if (line.empty() || line[0] == '.' || is_label_line(line))
+            continue;
+        auto instruction = Instruction::Parse(line);
+        if (!instruction.IsComment())
+            instructions.push_back(instruction);
+    }
+    return instructions;
+}
+
+
+// compiles a sequence of statements, those after a jump are never reached
+static Code CompileStatements(LocalContext& ctx, const vector<shared_ptr<Statement>>& statements)
+{
+    Code code;
+    bool reachable = true;
+    for (auto s : statements)
+    {
+        if (reachable)
+            code += s->Compile(ctx);
+        else
+            CheckUnreachable(ctx, [&]() { return s->Compile(ctx); });
+
+        if (std::dynamic_pointer_cast<JumpStatement>(s))
+            reachable = false;
+    }
+    return code;
+}
+
+
 std::pair<Code, shared_ptr<Symbol>> ValueCast::Evaluate(ExpressionContext& ctx)
 {
+    if (exp->BranchFree())
+        return exp->EvaluateValue(ctx, false);
+
     string set_label = ctx.local_context.global_context.NewLabel(),
         clear_label = ctx.local_context.global_context.NewLabel(),
         assign_label = ctx.local_context.global_context.NewLabel();
-    Code code = exp->Evaluate(ctx, set_label, clear_label);
+    Code code = exp->Evaluate(ctx, set_label, clear_label, set_label);
 
     auto symbol = ctx.NewTemp(exp->location);
     code += set_label + ":\n";
-    code += tab + "li $v0, 1\n";
+    code += tab + "li " + symbol->reg + ", 1\n";
     code += tab + "b " + assign_label + "\n";
     code += clear_label + ":\n";
-    code += tab + "move $v0, $zero\n";
+    code += tab + "move " + symbol->reg + ", $zero\n";
     code += assign_label + ":\n";
-    code += symbol->SaveValue("$v0");
     return std::make_pair(code, symbol);
 };
 
-Code BooleanCast::Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label)
+Code BooleanCast::Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label,
+    const string& next_label)
 {
+    bool value;
+    if (Precomputable(value))
+        return BranchTo(value ? true_label : false_label, next_label);
+
     ExpressionContext inner = ctx;
     auto [code, symbol] = exp->Evaluate(inner);
+    auto [load_code, reg] = inner.ValueRegister(symbol);
 
-    code += symbol->LoadValue("$v0");
-    code += tab + "beq $v0, $zero, " + false_label + "\n";
-    code += tab + "b " + true_label + "\n";
+    code += load_code;
+    if (next_label == false_label)
+        code += tab + "bnez " + reg + ", " + true_label + "\n";
+    else
+    {
+        code += tab + "beqz " + reg + ", " + false_label + "\n";
+        code += BranchTo(true_label, next_label);
+    }
     return code;
 };
 
+std::pair<Code, shared_ptr<Symbol>> BooleanCast::EvaluateValue(ExpressionContext& ctx, bool negated)
+{
+    ExpressionContext inner = ctx;
+    auto [code, symbol] = exp->Evaluate(inner);
+    auto [load_code, reg] = inner.ValueRegister(symbol);
+
+    auto result = ctx.NewTemp(location);
+    code += load_code;
+    if (negated)
+        code += tab + "sltiu " + result->reg + ", " + reg + ", 1\n";
+    else
+        code += tab + "sltu " + result->reg + ", $zero, " + reg + "\n";
+    return std::make_pair(code, result);
+}
+
 std::pair<Code, shared_ptr<Symbol>> UnaryValueExpression::Evaluate(ExpressionContext& ctx)
 {
     ExpressionContext inner = ctx;
     auto [code, symbol0] = exp->Evaluate(inner);
+    auto [load_code, reg] = inner.ValueRegister(symbol0);
 
     auto symbol = ctx.NewTemp(location);
 
-    code += symbol0->LoadValue("$v0");
-    code += tab + op_to_instruction.at(op) + " $v0, $v0\n";
-    code += symbol->SaveValue("$v0");
+    code += load_code;
+    code += tab + op_to_instruction.at(op) + " " + symbol->reg + ", " + reg + "\n";
     return std::make_pair(code, symbol);
 }
 
@@ -50,28 +160,31 @@ std::pair<Code, shared_ptr<Symbol>> BinaryValueExpression::Evaluate(ExpressionCo
 {
     // warn about division by zero
     int den;
-    if (exp2->Precomputable(den) && den == 0)
+    if ((op == "/" || op == "%") && exp2->Precomputable(den) && den == 0)
         ctx.local_context.global_context.printer(location, "divide by zero", "warning");
 
+    // constants go second where the operator allows it
+    auto left = exp1, right = exp2;
+    if (std::dynamic_pointer_cast<ConstantExpression>(left) && op != "-" && op != "/" && op != "%")
+        std::swap(left, right);
+
     ExpressionContext inner = ctx;
-    auto [code1, symbol1] = exp1->Evaluate(inner);
-    auto [code2, symbol2] = exp2->Evaluate(inner);
+    auto [code1, symbol1] = left->Evaluate(inner);
+    auto [code2, operand2] = EvaluateOperand(inner, right);
+
+    auto [load_code1, reg1] = inner.ValueRegister(symbol1);
 
     auto symbol = ctx.NewTemp(location);
-    Code code = code1 + code2;
+    Code code = code1 + code2 + load_code1;
 
-    code += symbol1->LoadValue("$v0");
-    code += symbol2->LoadValue("$v1");
-    code += tab + op_to_instruction.at(op) + " $v0, $v0, $v1\n";
-    code += symbol->SaveValue("$v0");
+    code += tab + op_to_instruction.at(op) + " " + symbol->reg + ", " + reg1 + ", " + operand2 + "\n";
     return std::make_pair(code, symbol);
 }
 
 std::pair<Code, shared_ptr<Symbol>> ConstantExpression::Evaluate(ExpressionContext& ctx)
 {
     auto symbol = ctx.NewTemp(location);
-    Code code = tab + "li $v0, " + std::to_string(value) + "\n";
-    code += symbol->SaveValue("$v0");
+    Code code = tab + "li " + symbol->reg + ", " + std::to_string(value) + "\n";
     return std::make_pair(code, symbol);
 }
 
@@ -91,14 +204,14 @@ std::pair<Code, shared_ptr<Symbol>> ArrayAccessExpression::Evaluate(ExpressionCo
 
     ExpressionContext inner = ctx;
     auto [code, index_symbol] = index->Evaluate(inner);
+    auto [load_code, index_reg] = inner.ValueRegister(index_symbol);
+    code += load_code;
 
     if (is_array_type(symbol->type))
-        code += EnsureIndexInRange(ctx, symbol, index_symbol);
+        code += EnsureIndexInRange(ctx, symbol, index_reg);
 
     auto temp = ctx.NewTemp(location);
-    code += index_symbol->LoadValue("$v0");
-    code += symbol->LoadElementValue("$v0", "$v0");
-    code += temp->SaveValue("$v0");
+    code += symbol->LoadElementValue(index_reg, temp->reg);
     
     return std::make_pair(code, temp);
 }
@@ -110,39 +223,40 @@ Code ArrayAccessExpression::Assign(ExpressionContext& ctx, shared_ptr<Symbol> va
         throw CompileError(location, "undefined symbol \"" + name + "\"");
 
     auto [code, index_symbol] = index->Evaluate(ctx);
+    auto [load_code, index_reg] = ctx.ValueRegister(index_symbol);
+    code += load_code;
 
     if (is_array_type(symbol->type))
-        code += EnsureIndexInRange(ctx, symbol, index_symbol);
+        code += EnsureIndexInRange(ctx, symbol, index_reg);
 
-    code += value->LoadValue("$v0");
-    code += index_symbol->LoadValue("$v1");
-    code += symbol->SaveElementValue("$v1", "$v0");
+    auto [value_code, value_reg] = ctx.ValueRegister(value);
+    code += value_code;
+
+    // the index register is overwritten with the element address
+    auto address = ctx.NewTemp(location);
+    code += tab + "move " + address->reg + ", " + index_reg + "\n";
+    code += symbol->SaveElementValue(address->reg, value_reg);
     return code;
 }
 
 Code ArrayAccessExpression::EnsureIndexInRange(ExpressionContext& ctx,
-        shared_ptr<Symbol> array_symbol, shared_ptr<Symbol> index_symbol)
+        shared_ptr<Symbol> array_symbol, const string& index_reg)
 {
     auto array_type = as_array_type(array_symbol->type);
 
     // compile-time check
     int index_value;
-    if (index->Precomputable(index_value) && (index_value < 0 || index_value >= int(array_type->size)))
-        throw CompileError(location, "array index is out of bounds");
+    if (index->Precomputable(index_value))
+    {
+        if (index_value < 0 || index_value >= int(array_type->size))
+            throw CompileError(location, "array index is out of bounds");
+        return Code();
+    }
 
-    // runtime check (might consider changing to a break instruction)
-    string error_label = ctx.local_context.global_context.NewLabel();
-    string end_label = ctx.local_context.global_context.NewLabel();
-    Code code;
-    code += tab + "# runtime array index bounds check\n";
-    code += index_symbol->LoadValue("$t0");
-    code += tab + "bltz $t0, " + error_label + "\n";
-    code += tab + "bgeu $t0, " + std::to_string(array_type->size) + ", " + error_label + "\n";
-    code += tab + "b " + end_label + "\n";
-    code += error_label + ":\n";
-    code += tab + "jal " + ctx.local_context["$out_of_bounds_error"]->name + "\n";
-    code += end_label + ":\n";
-    return code;
+    // runtime check, a negative index compares above the size as unsigned; the error routine
+    // doesn't return, and EliminateBoundsChecks drops or hoists the checks it can prove
+    return tab + "bgeu " + index_reg + ", " + std::to_string(array_type->size) + ", " +
+        ctx.local_context["$out_of_bounds_error"]->name + " # array index bounds check\n";
 }
 
 std::pair<Code, shared_ptr<Symbol>> AssignmentExpression::Evaluate(ExpressionContext& ctx)
@@ -159,7 +273,7 @@ std::pair<Code, shared_ptr<Symbol>> AssignmentExpression::Evaluate(ExpressionCon
     return std::make_pair(code, value);
 }
 
-std::pair<Code, shared_ptr<Symbol>> FunctionCallExpression::Evaluate(ExpressionContext& ctx)
+shared_ptr<FunctionSymbol> FunctionCallExpression::Function(ExpressionContext& ctx)
 {
     auto symbol = ctx.local_context[name];
     if (!symbol)
@@ -172,36 +286,114 @@ std::pair<Code, shared_ptr<Symbol>> FunctionCallExpression::Evaluate(ExpressionC
     if (function_symbol->param_types.size() != args.size())
         throw CompileError(location, "incorrect number of arguments");
 
-    ExpressionContext inner = ctx;
+    return function_symbol;
+}
+
+std::pair<Code, vector<shared_ptr<Symbol>>> FunctionCallExpression::EvaluateArguments(ExpressionContext& ctx,
+    const FunctionSymbol& function_symbol)
+{
     vector<shared_ptr<Symbol>> symbols;
     Code code;
 
     for (size_t i = 0; i < args.size(); i++)
     {
-        auto [c, s] = args[i]->Evaluate(inner);
+        // constants are loaded straight into the argument register
+        shared_ptr<Symbol> s;
+        shared_ptr<SymbolType> type = int_type;
+        if (!std::dynamic_pointer_cast<ConstantExpression>(args[i]))
+        {
+            auto [c, symbol] = args[i]->Evaluate(ctx);
+            code += c;
+            s = symbol;
+            type = s->type;
+        }
 
-        if (!function_symbol->param_types[i]->CompatibleWith(s->type))
-            throw CompileError(location, "argument of type " + function_symbol->param_types[i]->Name() +
-                " is not compatible with type " + s->type->Name());
+        if (!function_symbol.param_types[i]->CompatibleWith(type))
+            throw CompileError(location, "argument of type " + function_symbol.param_types[i]->Name() +
+                " is not compatible with type " + type->Name());
 
         symbols.push_back(s);
-        code += c;
     }
-    
-    for (size_t i = 0; i < symbols.size(); i++)
+
+    return std::make_pair(code, symbols);
+}
+
+Code FunctionCallExpression::LoadArgument(size_t i, shared_ptr<Symbol> symbol, shared_ptr<SymbolType> type,
+    const string& reg)
+{
+    if (auto constant = std::dynamic_pointer_cast<ConstantExpression>(args[i]))
     {
-        auto pt = function_symbol->param_types[i];
-        string reg = "$a" + std::to_string(i);
+        int value = constant->value;
+        if (*type == *char_type) value &= 0xff;
+        return tab + "li " + reg + ", " + std::to_string(value) + "\n";
+    }
+
+    Code code = symbol->LoadValue(reg);
+    if (*type == *char_type)
+        code += tab + "and " + reg + ", " + reg + ", 0xff\n";
+    return code;
+}
+
+FunctionDefinition* FunctionCallExpression::InlinedDefinition(ExpressionContext& ctx)
+{
+    // a small function is compiled in place of the call when that grows the code by no more than
+    // the threshold, counting the argument moves, jal, jr and result move that go away
+    auto& global = ctx.local_context.global_context;
+    auto candidate = global.inline_candidates.find(name);
+    if (candidate == global.inline_candidates.end() || global.options.inline_threshold < 0 ||
+        candidate->second.second > global.options.inline_threshold + int(args.size()) + 3)
+        return nullptr;
+
+    // a function already being inlined around this call is not expanded again
+    for (auto c = ctx.local_context.InlinedCall(); c != nullptr;
+        c = c->previous_context ? c->previous_context->InlinedCall() : nullptr)
+        if (c->inlined_function == name)
+            return nullptr;
+
+    return candidate->second.first;
+}
+
+std::pair<Code, shared_ptr<Symbol>> FunctionCallExpression::Evaluate(ExpressionContext& ctx)
+{
+    auto function_symbol = Function(ctx);
 
-        code += symbols[i]->LoadValue(reg);
-        if (*pt == *char_type)
-            code += tab + "and " + reg + ", " + reg + ", 0xff\n";
+    auto& global = ctx.local_context.global_context;
+    if (name == ctx.local_context.function_context.function_symbol.name)
+        global.recursive_functions.insert(name);
+
+    ExpressionContext inner = ctx;
+    auto [code, symbols] = EvaluateArguments(inner, *function_symbol);
+
+    if (auto definition = InlinedDefinition(ctx))
+    {
+        global.inline_report.push_back("inline: " + name + " into " +
+            ctx.local_context.function_context.function_symbol.name + " at line " +
+            std::to_string(location.begin.line) + ", " +
+            std::to_string(global.inline_candidates[name].second) + " instructions");
+        auto [inlined_code, result] = Inline(ctx, *definition, symbols);
+        return std::make_pair(code + inlined_code, result);
     }
 
-    code += tab + "jal " + function_symbol->name + "\n";
+    return Call(ctx, *function_symbol, code, symbols);
+}
+
+std::pair<Code, shared_ptr<Symbol>> FunctionCallExpression::Call(ExpressionContext& ctx,
+    const FunctionSymbol& function_symbol, Code code, const vector<shared_ptr<Symbol>>& symbols)
+{
+    for (size_t i = 0; i < symbols.size(); i++)
+        code += LoadArgument(i, symbols[i], function_symbol.param_types[i], "$a" + std::to_string(i));
+
+    // a system call only changes $v0, the values live in other registers stay there
+    if (function_symbol.syscall >= 0)
+    {
+        code += tab + "li $v0, " + std::to_string(function_symbol.syscall) + "\n";
+        code += tab + "syscall # " + function_symbol.name + "\n";
+    }
+    else
+        code += tab + "jal " + function_symbol.name + "\n";
 
     shared_ptr<Symbol> result;
-    if (*function_symbol->type == *void_type)
+    if (*function_symbol.type == *void_type)
         result = std::make_shared<VoidSymbol>(location);
     else
     {
@@ -212,44 +404,252 @@ std::pair<Code, shared_ptr<Symbol>> FunctionCallExpression::Evaluate(ExpressionC
     return std::make_pair(code, result);
 }
 
-Code UnaryBooleanExpression::Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label)
+std::pair<Code, shared_ptr<Symbol>> FunctionCallExpression::EvaluateTail(ExpressionContext& ctx)
 {
-    return exp->Evaluate(ctx, false_label, true_label);
+    auto function_symbol = Function(ctx);
+
+    auto& fctx = ctx.local_context.function_context;
+    SymbolType& return_type = *fctx.function_symbol.type;
+    bool self = name == fctx.function_symbol.name;
+
+    // the value returned by another function is returned as it is, so it must need no conversion,
+    // main exits instead of returning and a system call has no function to jump to
+    if (!self && (fctx.function_symbol.name == "main" || InlinedDefinition(ctx) != nullptr ||
+        function_symbol->syscall >= 0 || *function_symbol->type == *void_type ||
+        (return_type == *char_type && !(*function_symbol->type == *char_type))))
+        return Evaluate(ctx);
+
+    if (self)
+        ctx.local_context.global_context.recursive_functions.insert(name);
+
+    auto [code, symbols] = EvaluateArguments(ctx, *function_symbol);
+
+    // the frame is reused or torn down, so no argument may point into it
+    if (std::any_of(symbols.begin(), symbols.end(),
+        [](auto& s) { return std::dynamic_pointer_cast<VariableSymbol>(s) != nullptr; }))
+        return Call(ctx, *function_symbol, code, symbols);
+
+    if (self)
+    {
+        // the arguments are loaded before any parameter is overwritten, the parameters being
+        // the first symbols of the function
+        vector<string> values;
+        for (size_t i = 0; i < symbols.size(); i++)
+        {
+            auto temp = ctx.NewTemp(location);
+            code += LoadArgument(i, symbols[i], function_symbol->param_types[i], temp->reg);
+            values.push_back(temp->reg);
+        }
+        for (size_t i = 0; i < values.size(); i++)
+            code += fctx.symbols[i]->SaveValue(values[i]);
+
+        fctx.tail_recursive = true;
+        code += tab + "b " + fctx.start_label + "\n";
+    }
+    else
+    {
+        // StackFrame::Wrap tears the frame down in front of the jump
+        for (size_t i = 0; i < symbols.size(); i++)
+            code += LoadArgument(i, symbols[i], function_symbol->param_types[i], "$a" + std::to_string(i));
+        code += tab + "j " + name + " # tail call\n";
+    }
+
+    return std::make_pair(code, nullptr);
 }
 
-Code BinaryBooleanExpression::Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label)
+std::pair<Code, shared_ptr<Symbol>> FunctionCallExpression::Inline(ExpressionContext& ctx,
+    FunctionDefinition& definition, const vector<shared_ptr<Symbol>>& symbols)
 {
+    auto& global = ctx.local_context.global_context;
+
+    // the parameters are variables of a context that hides the variables of the caller
+    LocalContext inline_ctx(ctx.local_context);
+    inline_ctx.inlined_function = name;
+    inline_ctx.return_label = global.NewLabel() + "_return";
+    inline_ctx.return_type = definition.type;
+
+    shared_ptr<Symbol> result;
+    if (*definition.type == *void_type)
+        result = std::make_shared<VoidSymbol>(location);
+    else
+    {
+        auto temp = ctx.NewTemp(location);
+        inline_ctx.return_register = temp->reg;
+        result = temp;
+    }
+
+    Code code;
+    for (size_t i = 0; i < symbols.size(); i++)
+    {
+        auto& param = definition.params[i];
+        auto symbol = std::make_shared<RegisterSymbol>(param->name, param->type,
+            ctx.local_context.function_context.NewRegister(), param->location);
+        inline_ctx.symbols.push_back(symbol);
+        code += LoadArgument(i, symbols[i], param->type, symbol->reg);
+    }
+
+    // warnings were given when the function itself was compiled
+    auto printer = global.printer;
+    global.printer = [](const Location&, const string&, const string&) {};
+    code += definition.body->Compile(inline_ctx);
+    global.printer = printer;
+
+    code += inline_ctx.return_label + ":\n";
+    return std::make_pair(code, result);
+}
+
+Code UnaryBooleanExpression::Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label,
+    const string& next_label)
+{
+    return exp->Evaluate(ctx, false_label, true_label, next_label);
+}
+
+Code BinaryBooleanExpression::Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label,
+    const string& next_label)
+{
+    bool value;
+    if (Precomputable(value))
+        return BranchTo(value ? true_label : false_label, next_label);
+    // a constant first operand that doesn't decide leaves the second one alone
+    if (exp1->Precomputable(value))
+        return exp2->Evaluate(ctx, true_label, false_label, next_label);
+
     string inner_label = ctx.local_context.global_context.NewLabel();
 
     if (op == "&&")
     {
-        Code code = exp1->Evaluate(ctx, inner_label, false_label);
+        Code code = exp1->Evaluate(ctx, inner_label, false_label, inner_label);
         code += inner_label + ":\n";
-        code += exp2->Evaluate(ctx, true_label, false_label);
+        code += exp2->Evaluate(ctx, true_label, false_label, next_label);
         return code;
     }
     if (op == "||")
     {
-        Code code = exp1->Evaluate(ctx, true_label, inner_label);
+        Code code = exp1->Evaluate(ctx, true_label, inner_label, inner_label);
         code += inner_label + ":\n";
-        code += exp2->Evaluate(ctx, true_label, false_label);
+        code += exp2->Evaluate(ctx, true_label, false_label, next_label);
         return code;
     }
     
     assert(false); // must not happen
 }
 
-Code RelationalExpression::Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label)
+std::pair<Code, shared_ptr<Symbol>> BinaryBooleanExpression::EvaluateValue(ExpressionContext& ctx, bool negated)
 {
+    // the negation of a && b is !a || !b and the other way around
     ExpressionContext inner = ctx;
-    auto [code1, symbol1] = exp1->Evaluate(inner);
-    auto [code2, symbol2] = exp2->Evaluate(inner);
-
-    Code code = code1 + code2;
-    code += symbol1->LoadValue("$v0");
-    code += symbol2->LoadValue("$v1");
-    code += tab + op_to_instruction.at(op) + " $v0, $v1, " + true_label + "\n";
-    code += tab + "b " + false_label + "\n";
+    auto [code1, symbol1] = exp1->EvaluateValue(inner, negated);
+    auto [code2, symbol2] = exp2->EvaluateValue(inner, negated);
+    auto [load_code1, reg1] = inner.ValueRegister(symbol1);
+    auto [load_code2, reg2] = inner.ValueRegister(symbol2);
+
+    auto result = ctx.NewTemp(location);
+    Code code = code1 + code2 + load_code1 + load_code2;
+    code += tab + ((op == "&&") != negated ? "and " : "or ") + result->reg + ", " + reg1 + ", " + reg2 + "\n";
+    return std::make_pair(code, result);
+}
+
+std::pair<Code, shared_ptr<Symbol>> RelationalExpression::EvaluateValue(ExpressionContext& ctx, bool negated)
+{
+    auto result = ctx.NewTemp(location);
+    string& dest = result->reg;
+
+    bool value;
+    if (Precomputable(value))
+        return std::make_pair(tab + "li " + dest + ", " + (value != negated ? "1" : "0") + "\n", result);
+
+    auto left = exp1, right = exp2;
+    string relation = negated ? negated_op.at(op) : op;
+    if (std::dynamic_pointer_cast<ConstantExpression>(left))
+    {
+        std::swap(left, right);
+        relation = swapped_op.at(relation);
+    }
+
+    ExpressionContext inner = ctx;
+    auto [code1, symbol1] = left->Evaluate(inner);
+    auto [code2, operand2] = EvaluateOperand(inner, right);
+    auto [load_code1, reg1] = inner.ValueRegister(symbol1);
+    Code code = code1 + code2 + load_code1;
+
+    // equality is a zero difference, compared unsigned with 1
+    if (relation == "==" || relation == "!=")
+    {
+        string difference = reg1;
+        if (operand2 != "$zero")
+        {
+            difference = inner.NewTemp(location)->reg;
+            code += tab + "xor " + difference + ", " + reg1 + ", " + operand2 + "\n";
+        }
+        if (relation == "==")
+            code += tab + "sltiu " + dest + ", " + difference + ", 1\n";
+        else
+            code += tab + "sltu " + dest + ", $zero, " + difference + "\n";
+        return std::make_pair(code, result);
+    }
+
+    // the others are a less than, with the operands swapped for > and <=, and the result
+    // flipped for >= and <=; slt only takes an immediate second operand
+    int constant;
+    if (!is_register(operand2) && relation == "<=" && right->Precomputable(constant) && constant < INT_MAX)
+    {
+        code += tab + "slt " + dest + ", " + reg1 + ", " + std::to_string(constant + 1) + "\n";
+        return std::make_pair(code, result);
+    }
+
+    if (!is_register(operand2) && (relation == ">" || relation == "<="))
+    {
+        string reg2 = inner.NewTemp(location)->reg;
+        code += tab + "li " + reg2 + ", " + operand2 + "\n";
+        operand2 = reg2;
+    }
+
+    bool swap = relation == ">" || relation == "<=", flip = relation == ">=" || relation == "<=";
+    string less = flip ? inner.NewTemp(location)->reg : dest;
+    code += tab + "slt " + less + ", " + (swap ? operand2 + ", " + reg1 : reg1 + ", " + operand2) + "\n";
+    if (flip)
+        code += tab + "xori " + dest + ", " + less + ", 1\n";
+    return std::make_pair(code, result);
+}
+
+Code RelationalExpression::Evaluate(ExpressionContext& ctx, const string& true_label, const string& false_label,
+    const string& next_label)
+{
+    bool value;
+    if (Precomputable(value))
+        return BranchTo(value ? true_label : false_label, next_label);
+
+    // constants go second, comparing with an immediate
+    auto left = exp1, right = exp2;
+    string relation = op;
+    if (std::dynamic_pointer_cast<ConstantExpression>(left))
+    {
+        std::swap(left, right);
+        relation = swapped_op.at(op);
+    }
+
+    ExpressionContext inner = ctx;
+    auto [code1, symbol1] = left->Evaluate(inner);
+    auto [code2, operand2] = EvaluateOperand(inner, right);
+
+    auto [load_code1, reg1] = inner.ValueRegister(symbol1);
+
+    auto branch = [&](const string& relation, const string& label)
+    {
+        if (operand2 == "$zero")
+            return tab + zero_op_to_instruction.at(relation) + " " + reg1 + ", " + label + "\n";
+        return tab + op_to_instruction.at(relation) + " " + reg1 + ", " + operand2 + ", " + label + "\n";
+    };
+
+    // the test is reversed to fall through to the true label
+    Code code = code1 + code2 + load_code1;
+    if (next_label == true_label)
+        code += branch(negated_op.at(relation), false_label);
+    else
+    {
+        code += branch(relation, true_label);
+        code += BranchTo(false_label, next_label);
+    }
     return code;
 }
 
@@ -277,7 +677,10 @@ Code BreakStatement::Compile(LocalContext& ctx)
 
 Code ReturnStatement::Compile(LocalContext& ctx)
 {
-    SymbolType& return_type = *ctx.function_context.function_symbol.type;
+    // the body of an inlined function returns to the end of the call instead
+    auto inlined = ctx.InlinedCall();
+    SymbolType& return_type = inlined ? *inlined->return_type : *ctx.function_context.function_symbol.type;
+    string reg = inlined ? inlined->return_register : "$v0";
 
     Code code;
     if (exp != nullptr && (return_type == *int_type || return_type == *char_type))
@@ -286,33 +689,52 @@ Code ReturnStatement::Compile(LocalContext& ctx)
         if (exp->Precomputable(value))
         {
             if (return_type == *char_type) value &= 0xff;
-            code += tab + "li $v0, " + std::to_string(value) + "\n";
+            code += tab + "li " + reg + ", " + std::to_string(value) + "\n";
         }
         else
         {
+            // a call outside of inlined bodies may leave the function without coming back
             ExpressionContext inner = ctx;
-            auto [exp_code, symbol] = exp->Evaluate(inner);
+            auto call = std::dynamic_pointer_cast<FunctionCallExpression>(exp);
+            auto [exp_code, symbol] = call && !inlined ? call->EvaluateTail(inner) : exp->Evaluate(inner);
             code += exp_code;
-            code += symbol->LoadValue("$v0");
+            if (symbol == nullptr)
+                return code;
+
+            code += symbol->LoadValue(reg);
             if (return_type == *char_type)
-                code += tab + "and $v0, $v0, 0xff\n";
+                code += tab + "and " + reg + ", " + reg + ", 0xff\n";
         }
     }
     else if (!(exp == nullptr && return_type == *void_type))
         throw CompileError(location, "return value type does not match function return type");
 
-    code += tab + "b " + ctx.function_context.epilouge_label + "\n";
+    code += tab + "b " + (inlined ? inlined->return_label : ctx.function_context.epilouge_label) + "\n";
     return code;
 }
 
 Code IfElseStatement::Compile(LocalContext& ctx)
 {
+    // only the block taken by a constant condition is emitted
+    bool value;
+    if (condition->Precomputable(value))
+    {
+        if (!value)
+        {
+            CheckUnreachable(ctx, [&]() { return then_block->Compile(ctx); });
+            return else_block->Compile(ctx);
+        }
+        Code code = then_block->Compile(ctx);
+        CheckUnreachable(ctx, [&]() { return else_block->Compile(ctx); });
+        return code;
+    }
+
     string label = ctx.global_context.NewLabel();
     string then_label = label + "_then", else_label = label + "_else", end_label = label + "_end";
 
     Code code;
     ExpressionContext inner = ctx;
-    code += condition->Evaluate(inner, then_label, else_label);
+    code += condition->Evaluate(inner, then_label, else_label, then_label);
     code += then_label + ":\n";
     code += then_block->Compile(ctx);
     code += tab + "b " + end_label + "\n";
@@ -322,6 +744,11 @@ Code IfElseStatement::Compile(LocalContext& ctx)
     return code;
 }
 
+Code StatementBlock::CompileOnContext(LocalContext& ctx)
+{
+    return CompileStatements(ctx, statements);
+}
+
 Code SwitchStatement::Compile(LocalContext& parent_ctx)
 {
     LocalContext ctx = parent_ctx;
@@ -331,15 +758,52 @@ Code SwitchStatement::Compile(LocalContext& parent_ctx)
 
     ExpressionContext inner = ctx;
     auto [code, symbol] = exp->Evaluate(inner);
+    auto [load_code, reg] = inner.ValueRegister(symbol);
 
     ctx.break_label = end_label;
 
-    code += symbol->LoadValue("$v0");
+    code += load_code;
+
+    vector<std::pair<int, size_t>> cases;
     for (size_t i = 0; i < case_values.size(); i++)
         if (case_values[i] != nullptr)
-            code += tab + "beq $v0, " + std::to_string(*case_values[i]) + ", " + case_label + std::to_string(i) + "\n";
-    code += tab + "b " + default_label + "\n";
-    
+            cases.push_back(std::make_pair(*case_values[i], i));
+    std::sort(cases.begin(), cases.end());
+
+    // without a default case, values matching no case skip the switch
+    string fallback = std::find(case_values.begin(), case_values.end(), nullptr) != case_values.end() ?
+        default_label : end_label;
+
+    long long span = cases.empty() ? 0 : (long long)cases.back().first - cases.front().first + 1;
+    if (cases.size() >= linear_cases && span <= (long long)(jump_table_density * cases.size()))
+    {
+        // jump table indexed by the value less the lowest case, the unsigned compare also
+        // sends values below the lowest case to the default
+        string table_label = label + "_table";
+        string index = inner.NewTemp(location)->reg, offset = inner.NewTemp(location)->reg,
+            target = inner.NewTemp(location)->reg;
+        code += tab + "subu " + index + ", " + reg + ", " + std::to_string(cases.front().first) + "\n";
+        code += tab + "bgeu " + index + ", " + std::to_string(span) + ", " + fallback + "\n";
+        code += tab + "sll " + offset + ", " + index + ", 2\n";
+        code += tab + "lw " + target + ", " + table_label + "(" + offset + ")\n";
+        code += tab + "jr " + target + "\n";
+
+        code += ".data\n";
+        code += table_label + ":\n";
+        code += tab + ".word ";
+        for (size_t k = 0, value = 0; value < size_t(span); value++)
+        {
+            code += value == 0 ? "" : ", ";
+            if ((long long)cases[k].first - cases.front().first == (long long)value)
+                code += case_label + std::to_string(cases[k++].second);
+            else
+                code += fallback;
+        }
+        code += "\n.text\n";
+    }
+    else
+        code += Dispatch(ctx, reg, cases, 0, cases.size(), case_label, fallback);
+
     for (size_t i = 0; i < case_bodies.size(); i++)
     {
         if (case_values[i] != nullptr)
@@ -347,14 +811,267 @@ Code SwitchStatement::Compile(LocalContext& parent_ctx)
         else
             code += default_label + ":\n";
 
-        for (size_t j = 0; j < case_bodies[i].size(); j++)
-            code += case_bodies[i][j]->Compile(ctx);
+        code += CompileStatements(ctx, case_bodies[i]);
     }
     code += end_label + ":\n";
 
     return code;
 }
 
+Code SwitchStatement::Dispatch(LocalContext& ctx, const string& reg, const vector<std::pair<int, size_t>>& cases,
+    size_t begin, size_t end, const string& case_label, const string& default_label)
+{
+    Code code;
+    if (end - begin < linear_cases)
+    {
+        for (size_t k = begin; k < end; k++)
+            code += tab + "beq " + reg + ", " + std::to_string(cases[k].first) + ", " +
+                case_label + std::to_string(cases[k].second) + "\n";
+        code += tab + "b " + default_label + "\n";
+        return code;
+    }
+
+    // values below the middle case go to the left half
+    size_t middle = (begin + end) / 2;
+    string left_label = ctx.global_context.NewLabel();
+    code += tab + "blt " + reg + ", " + std::to_string(cases[middle].first) + ", " + left_label + "\n";
+    code += Dispatch(ctx, reg, cases, middle, end, case_label, default_label);
+    code += left_label + ":\n";
+    code += Dispatch(ctx, reg, cases, begin, middle, case_label, default_label);
+    return code;
+}
+
+// an element of a character array or pointer indexed by an int variable, a[i]
+static bool CharacterElement(LocalContext& ctx, shared_ptr<Expression> exp, shared_ptr<Symbol>& array,
+    shared_ptr<RegisterSymbol>& counter)
+{
+    auto access = std::dynamic_pointer_cast<ArrayAccessExpression>(exp);
+    auto index = access ? std::dynamic_pointer_cast<VariableExpression>(access->index) : nullptr;
+    if (index == nullptr)
+        return false;
+
+    array = ctx[access->name];
+    counter = std::dynamic_pointer_cast<RegisterSymbol>(ctx[index->name]);
+    if (array == nullptr || counter == nullptr || !(*counter->type == *int_type))
+        return false;
+
+    if (is_array_type(array->type))
+        return *as_array_type(array->type)->underlying_type == *char_type;
+    return is_pointer_type(array->type) && *as_pointer_type(array->type)->underlying_type == *char_type;
+}
+
+// the int variable a statement counts up by one, i = i + 1 or i = 1 + i
+static shared_ptr<RegisterSymbol> Increment(LocalContext& ctx, shared_ptr<Statement> statement)
+{
+    auto assignment = std::dynamic_pointer_cast<AssignmentExpression>(statement);
+    auto variable = assignment ? std::dynamic_pointer_cast<VariableExpression>(assignment->left) : nullptr;
+    auto sum = assignment ? std::dynamic_pointer_cast<BinaryValueExpression>(assignment->exp) : nullptr;
+    if (variable == nullptr || sum == nullptr || sum->op != "+")
+        return nullptr;
+
+    auto is_one = [](shared_ptr<ValueExpression> exp)
+    {
+        auto constant = std::dynamic_pointer_cast<ConstantExpression>(exp);
+        return constant != nullptr && constant->value == 1;
+    };
+    auto is_variable = [&](shared_ptr<ValueExpression> exp)
+    {
+        auto v = std::dynamic_pointer_cast<VariableExpression>(exp);
+        return v != nullptr && v->name == variable->name;
+    };
+    if (!(is_variable(sum->exp1) && is_one(sum->exp2)) && !(is_one(sum->exp1) && is_variable(sum->exp2)))
+        return nullptr;
+
+    auto counter = std::dynamic_pointer_cast<RegisterSymbol>(ctx[variable->name]);
+    return counter && *counter->type == *int_type ? counter : nullptr;
+}
+
+// the value a condition tests against 0, c from c or c != 0
+static shared_ptr<ValueExpression> NonZero(shared_ptr<BooleanExpression> condition)
+{
+    if (auto cast = std::dynamic_pointer_cast<BooleanCast>(condition))
+        return cast->exp;
+    auto relational = std::dynamic_pointer_cast<RelationalExpression>(condition);
+    auto zero = relational ? std::dynamic_pointer_cast<ConstantExpression>(relational->exp2) : nullptr;
+    if (relational == nullptr || relational->op != "!=" || zero == nullptr || zero->value != 0)
+        return nullptr;
+    return relational->exp1;
+}
+
+// compiles a loop of a string routine as a call to the routine of the runtime doing the same a
+// word at a time, when the loop is one of
+//   the length of a string      for (. s[i]. i = i + 1) <>
+//   copying a string            while (d[j] = s[i]) < i = i + 1. j = j + 1. >
+//   the prefix two strings share while (a[i] == b[i] && a[i]) < i = i + 1. >
+//   filling a character array   for (. i < n. i = i + 1) a[i] = c.
+// statements are the body and the step of the loop; the counters are left where the loop would
+// leave them, and an array with a size is checked where the loop would check each element
+static bool CompileLoopIdiom(LocalContext& ctx, shared_ptr<BooleanExpression> condition,
+    const vector<shared_ptr<Statement>>& statements, const Location& location, Code& code)
+{
+    set<shared_ptr<RegisterSymbol>> counters;
+    vector<shared_ptr<Statement>> others;
+    for (auto& statement : statements)
+    {
+        auto counter = Increment(ctx, statement);
+        if (counter == nullptr)
+            others.push_back(statement);
+        else if (!counters.insert(counter).second)
+            return false;
+    }
+
+    // the arrays passed to the routine with the counters indexing them
+    vector<std::pair<shared_ptr<Symbol>, shared_ptr<RegisterSymbol>>> elements;
+    auto element = [&](shared_ptr<Expression> exp)
+    {
+        shared_ptr<Symbol> array;
+        shared_ptr<RegisterSymbol> counter;
+        if (!CharacterElement(ctx, exp, array, counter))
+            return false;
+        elements.emplace_back(array, counter);
+        return true;
+    };
+
+    // the value and the end of a fill, a constant or a variable
+    auto invariant = [&](shared_ptr<ValueExpression> exp)
+    {
+        if (std::dynamic_pointer_cast<ConstantExpression>(exp))
+            return true;
+        auto variable = std::dynamic_pointer_cast<VariableExpression>(exp);
+        auto symbol = variable ? ctx[variable->name] : nullptr;
+        return symbol != nullptr && is_value_type(symbol->type) && counters.count(
+            std::dynamic_pointer_cast<RegisterSymbol>(symbol)) == 0;
+    };
+
+    string routine;
+    shared_ptr<ValueExpression> fill_value, fill_end;
+    auto relational = std::dynamic_pointer_cast<RelationalExpression>(condition);
+    auto conjunction = std::dynamic_pointer_cast<BinaryBooleanExpression>(condition);
+    auto tested = NonZero(condition);
+    auto copied = tested ? std::dynamic_pointer_cast<AssignmentExpression>(tested) : nullptr;
+    if (!others.empty())
+    {
+        auto assignment = others.size() == 1 ? std::dynamic_pointer_cast<AssignmentExpression>(others[0]) : nullptr;
+        auto counter = relational && relational->op == "<" ?
+            std::dynamic_pointer_cast<VariableExpression>(relational->exp1) : nullptr;
+        if (assignment == nullptr || counter == nullptr || !element(assignment->left) ||
+            ctx[counter->name] != elements[0].second || !invariant(assignment->exp) || !invariant(relational->exp2))
+            return false;
+        routine = "$fill_bytes";
+        fill_value = assignment->exp;
+        fill_end = relational->exp2;
+    }
+    else if (copied != nullptr)
+    {
+        if (!element(copied->left) || !element(copied->exp))
+            return false;
+        routine = "$string_copy";
+    }
+    else if (tested != nullptr)
+    {
+        if (!element(tested))
+            return false;
+        routine = "$string_length";
+    }
+    else if (conjunction != nullptr && conjunction->op == "&&")
+    {
+        // one operand compares the elements, the other tests one of them for the end
+        auto equal = std::dynamic_pointer_cast<RelationalExpression>(conjunction->exp1);
+        auto end = NonZero(conjunction->exp2);
+        if (equal == nullptr || equal->op != "==")
+        {
+            equal = std::dynamic_pointer_cast<RelationalExpression>(conjunction->exp2);
+            end = NonZero(conjunction->exp1);
+        }
+        if (equal == nullptr || equal->op != "==" || end == nullptr ||
+            !element(equal->exp1) || !element(equal->exp2) || !element(end) ||
+            (elements[2] != elements[0] && elements[2] != elements[1]))
+            return false;
+        elements.pop_back();
+        routine = "$string_prefix";
+    }
+    else
+        return false;
+
+    // every index counts up once; only the length and the fill are checked against the size of an
+    // array up front, the other loops access some element past the one they stop at
+    set<shared_ptr<RegisterSymbol>> indices;
+    for (auto& [array, counter] : elements)
+    {
+        indices.insert(counter);
+        if (is_array_type(array->type) && routine != "$string_length" && routine != "$fill_bytes")
+            return false;
+    }
+    if (indices != counters)
+        return false;
+
+    ExpressionContext inner = ctx;
+    string error = ctx["$out_of_bounds_error"]->name;
+    auto size = [](shared_ptr<Symbol> array) { return std::to_string(as_array_type(array->type)->size); };
+    auto counter = elements[0].second;
+
+    // nothing is filled unless the counter is below the end, which it is left at
+    Code result;
+    string end_reg, skip_label;
+    if (fill_end)
+    {
+        auto [end_code, end_symbol] = fill_end->Evaluate(inner);
+        auto [load_code, reg] = inner.ValueRegister(end_symbol);
+        result += end_code + load_code;
+        end_reg = reg;
+        skip_label = ctx.global_context.NewLabel() + "_filled";
+        result += tab + "bge " + counter->reg + ", " + end_reg + ", " + skip_label + "\n";
+        if (is_array_type(elements[0].first->type))
+            result += tab + "bgt " + end_reg + ", " + size(elements[0].first) + ", " + error +
+                " # array index bounds check\n";
+    }
+
+    vector<string> arguments;
+    for (auto& [array, counter] : elements)
+    {
+        if (is_array_type(array->type))
+            result += tab + "bgeu " + counter->reg + ", " + size(array) + ", " + error + " # array index bounds check\n";
+        auto address = inner.NewTemp(location);
+        result += array->LoadValue(address->reg);
+        result += tab + "addu " + address->reg + ", " + address->reg + ", " + counter->reg + "\n";
+        arguments.push_back(address->reg);
+    }
+    if (fill_end)
+    {
+        auto [value_code, value_symbol] = fill_value->Evaluate(inner);
+        auto [load_code, value_reg] = inner.ValueRegister(value_symbol);
+        result += value_code + load_code;
+        arguments.push_back(value_reg);
+        auto count = inner.NewTemp(location);
+        result += tab + "subu " + count->reg + ", " + end_reg + ", " + counter->reg + "\n";
+        arguments.push_back(count->reg);
+    }
+
+    for (size_t i = 0; i < arguments.size(); i++)
+        result += tab + "move $a" + std::to_string(i) + ", " + arguments[i] + "\n";
+    result += tab + "jal " + ctx[routine]->name + "\n";
+
+    if (fill_end)
+    {
+        result += tab + "move " + counter->reg + ", " + end_reg + "\n";
+        result += skip_label + ":\n";
+    }
+    else
+    {
+        // the routine returns the number of characters the loop goes over
+        auto count = inner.NewTemp(location);
+        result += tab + "move " + count->reg + ", $v0\n";
+        for (auto& c : counters)
+            result += tab + "addu " + c->reg + ", " + c->reg + ", " + count->reg + "\n";
+        if (is_array_type(elements[0].first->type))
+            result += tab + "bgeu " + counter->reg + ", " + size(elements[0].first) + ", " + error +
+                " # array index bounds check\n";
+    }
+
+    code += result;
+    return true;
+}
+
 Code WhileStatement::Compile(LocalContext& ctx)
 {
     string label = ctx.global_context.NewLabel();
@@ -365,9 +1082,22 @@ Code WhileStatement::Compile(LocalContext& ctx)
 
     ExpressionContext inner = ctx;
 
+    // a constant condition is not tested, the loop runs until a jump out of it or not at all
+    bool value;
+    bool constant = condition->Precomputable(value);
+    if (constant && !value)
+    {
+        CheckUnreachable(ctx, [&]() { return body->Compile(ctx); });
+        return Code();
+    }
+
     Code code;
+    if (!constant && CompileLoopIdiom(ctx, condition, body->statements, location, code))
+        return code;
+
     code += loop_label + ":\n";
-    code += condition->Evaluate(inner, body_label, end_label);
+    if (!constant)
+        code += condition->Evaluate(inner, body_label, end_label, body_label);
     code += body_label + ":\n";
     code += body->Compile(ctx);
     code += tab + "b " + loop_label + "\n";
@@ -391,49 +1121,327 @@ Code ForStatement::Compile(LocalContext& parent_ctx)
     Code code;
     for (auto i : initializer)
         code += i->Compile(ctx);
+
+    bool value;
+    bool constant = condition->Precomputable(value);
+    if (constant && !value)
+    {
+        CheckUnreachable(ctx, [&]() { return body->Compile(ctx) + step->Compile(ctx); });
+        return code;
+    }
+
+    auto statements = body->statements;
+    statements.push_back(step);
+    if (!constant && CompileLoopIdiom(ctx, condition, statements, location, code))
+        return code;
+
+    Code test;
+    if (!constant)
+        test = condition->Evaluate(inner, body_label, end_label, body_label);
+    Code body_code = body->Compile(ctx);
+    Code step_code = step->Compile(ctx);
+
+    if (!constant && Unroll(ctx, label, body_code, step_code, code))
+        return code;
+
     code += loop_label + ":\n";
-    code += condition->Evaluate(inner, body_label, end_label);
+    code += test;
     code += body_label + ":\n";
-    code += body->Compile(ctx);
+    code += body_code;
     code += step_label + ":\n";
-    code += step->Compile(ctx);
+    code += step_code;
     code += tab + "b " + loop_label + "\n";
     code += end_label + ":\n";
     return code;
 }
 
-Code FieldDefinition::Compile(GlobalContext& ctx)
+bool ForStatement::Unroll(LocalContext& ctx, const string& label, const Code& body_code, const Code& step_code,
+    Code& code)
 {
-    ctx.DeclareField(FieldSymbol(name, type, location));
+    auto& options = ctx.global_context.options;
+    if (options.unroll_factor < 2)
+        return false;
+
+    // the condition compares an int variable with a constant or a variable, i < n, i <= n, i > n or i >= n
+    auto relational = std::dynamic_pointer_cast<RelationalExpression>(condition);
+    if (relational == nullptr || relational->op == "==" || relational->op == "!=")
+        return false;
+    const string& op = relational->op;
+    bool upwards = op == "<" || op == "<=";
+
+    auto variable = std::dynamic_pointer_cast<VariableExpression>(relational->exp1);
+    auto counter = variable ? std::dynamic_pointer_cast<RegisterSymbol>(ctx[variable->name]) : nullptr;
+    if (counter == nullptr || !(*counter->type == *int_type))
+        return false;
+
+    shared_ptr<RegisterSymbol> bound_symbol;
+    long long bound = 0;
+    if (auto constant = std::dynamic_pointer_cast<ConstantExpression>(relational->exp2))
+        bound = constant->value;
+    else if (auto bound_variable = std::dynamic_pointer_cast<VariableExpression>(relational->exp2))
+    {
+        bound_symbol = std::dynamic_pointer_cast<RegisterSymbol>(ctx[bound_variable->name]);
+        if (bound_symbol == nullptr || bound_symbol == counter || !is_value_type(bound_symbol->type))
+            return false;
+    }
+    else
+        return false;
 
-    Code code;
-    if (ctx.current_section != "data")
+    // the step adds a constant going towards the bound to the counter, i = i + c or i = i - c
+    auto is_counter = [&](shared_ptr<ValueExpression> exp)
     {
-        ctx.current_section = "data";
-        code += ".data\n";
+        auto v = std::dynamic_pointer_cast<VariableExpression>(exp);
+        return v != nullptr && v->name == variable->name;
+    };
+    auto assignment = std::dynamic_pointer_cast<AssignmentExpression>(step);
+    auto sum = assignment ? std::dynamic_pointer_cast<BinaryValueExpression>(assignment->exp) : nullptr;
+    if (sum == nullptr || !is_counter(assignment->left) || (sum->op != "+" && sum->op != "-"))
+        return false;
+    auto increment = std::dynamic_pointer_cast<ConstantExpression>(sum->exp2);
+    if (sum->op == "+" && increment == nullptr && is_counter(sum->exp2))
+        increment = std::dynamic_pointer_cast<ConstantExpression>(sum->exp1);
+    else if (!is_counter(sum->exp1))
+        return false;
+    if (increment == nullptr || increment->value == 0)
+        return false;
+    long long stride = sum->op == "+" ? increment->value : -(long long)increment->value;
+    if ((stride > 0) != upwards)
+        return false;
+
+    // the body must leave the counter and the bound alone; a loop up to a variable keeps its
+    // array bounds checks when unrolled, while EliminateBoundsChecks checks the whole loop once
+    // in front of a loop going one by one
+    auto instructions = Instructions(body_code);
+    for (auto& instruction : instructions)
+        for (auto& reg : instruction.Defs())
+            if (reg == counter->reg || (bound_symbol && reg == bound_symbol->reg))
+                return false;
+    if (bound_symbol && std::any_of(instructions.begin(), instructions.end(),
+        [&](auto& instruction) { return instruction.Target() == ctx["$out_of_bounds_error"]->name; }))
+        return false;
+
+    int size = int(instructions.size() + Instructions(step_code).size());
+    if (size == 0)
+        return false;
+
+    // the trip count is known when the counter starts from a constant the rest of the
+    // initializer doesn't change, and the last step doesn't overflow
+    long long trips = -1, init = 0;
+    for (auto it = initializer.rbegin(); it != initializer.rend() && !bound_symbol; ++it)
+    {
+        auto assigned = std::dynamic_pointer_cast<AssignmentExpression>(*it);
+        if (std::dynamic_pointer_cast<VariableDeclaration>(*it) != nullptr ||
+            (assigned && !is_counter(assigned->left) && std::dynamic_pointer_cast<ConstantExpression>(assigned->exp)))
+            continue;
+        auto value = assigned ? std::dynamic_pointer_cast<ConstantExpression>(assigned->exp) : nullptr;
+        if (value == nullptr)
+            break;
+
+        init = value->value;
+        long long distance = upwards ? bound - init : init - bound, magnitude = std::abs(stride);
+        bool inclusive = op == "<=" || op == ">=";
+        if (distance < 0 || (distance == 0 && !inclusive))
+            trips = 0;
+        else
+            trips = inclusive ? distance / magnitude + 1 : (distance + magnitude - 1) / magnitude;
+        if (init + trips * stride < INT_MIN || init + trips * stride > INT_MAX)
+            trips = -1;
+        break;
     }
+    if (trips == 0)
+        return false;
+
+    string step_label = label + "_step", end_label = label + "_end";
+    string unrolled_label = label + "_unrolled", rest_label = label + "_loop";
+
+    // the copies after the first one give no warnings again
+    auto& global = ctx.global_context;
+    auto printer = global.printer;
+    global.printer = [](const Location&, const string&, const string&) {};
+    size_t copies = 0;
+    auto copy = [&]()
+    {
+        ctx.continue_label = step_label + std::to_string(++copies);
+        return body->Compile(ctx) + ctx.continue_label + ":\n" + step->Compile(ctx);
+    };
+    Code first = body_code + step_label + ":\n" + step_code;
 
-    code += name + ":\n";
+    Code result;
+    if (trips > 0 && trips * size <= options.unroll_limit)
+    {
+        // the loop is replaced by one copy for every iteration
+        result += first;
+        for (long long k = 1; k < trips; k++)
+            result += copy();
+        result += end_label + ":\n";
+        global.printer = printer;
+        code += result;
+        return true;
+    }
+
+    int factor = options.unroll_factor;
+    while (factor > 1 && factor * size > options.unroll_limit)
+        factor--;
+
+    // a group of factor copies runs while as many iterations are left, which is while the
+    // counter passes the condition against the bound less factor - 1 steps
+    long long distance = (factor - 1) * stride;
+    string limit;
+    if (!bound_symbol)
+    {
+        if (bound - distance < INT_MIN || bound - distance > INT_MAX)
+            factor = 1;
+        limit = bound == distance ? "$zero" : std::to_string(bound - distance);
+    }
+    else
+    {
+        // a bound too close to the end of the int range would wrap around, the loop then goes
+        // one by one; the empty block after the check is the preheader of the unrolled loop
+        ExpressionContext inner = ctx;
+        limit = inner.NewTemp(location)->reg;
+        if (upwards)
+        {
+            result += tab + "subu " + limit + ", " + bound_symbol->reg + ", " + std::to_string(distance) + "\n";
+            result += tab + "bgt " + limit + ", " + bound_symbol->reg + ", " + rest_label + "\n";
+        }
+        else
+        {
+            result += tab + "addu " + limit + ", " + bound_symbol->reg + ", " + std::to_string(-distance) + "\n";
+            result += tab + "blt " + limit + ", " + bound_symbol->reg + ", " + rest_label + "\n";
+        }
+        result += label + "_preheader:\n";
+    }
+    if (factor < 2)
+    {
+        global.printer = printer;
+        return false;
+    }
+
+    static const map<string, string> exit_branch = {{"<", "bge"}, {"<=", "bgt"}, {">", "ble"}, {">=", "blt"}};
+    result += unrolled_label + ":\n";
+    result += tab + exit_branch.at(op) + " " + counter->reg + ", " + limit + ", " + rest_label + "\n";
+    if (trips > 0)
+    {
+        // the first copy is the first of the group, the counter leaves the loop at a known value
+        // and the iterations left run straight
+        result += first;
+        for (int k = 1; k < factor; k++)
+            result += copy();
+        result += tab + "b " + unrolled_label + "\n";
+        result += rest_label + ":\n";
+        if (trips % factor > 0)
+            result += tab + "li " + counter->reg + ", " + std::to_string(init + trips / factor * factor * stride) + "\n";
+        for (long long k = 0; k < trips % factor; k++)
+            result += copy();
+    }
+    else
+    {
+        // the first copy is the body of the loop running the iterations left one by one
+        for (int k = 0; k < factor; k++)
+            result += copy();
+        result += tab + "b " + unrolled_label + "\n";
+        result += rest_label + ":\n";
+        ExpressionContext inner = ctx;
+        result += condition->Evaluate(inner, label + "_body", end_label, label + "_body");
+        result += label + "_body:\n";
+        result += first;
+        result += tab + "b " + rest_label + "\n";
+    }
+    result += end_label + ":\n";
+
+    global.printer = printer;
+    code += result;
+    return true;
+}
+
+Code FieldDefinition::Compile(GlobalContext& ctx)
+{
+    Code allocation;
     if (auto valuetype = std::dynamic_pointer_cast<ValueType>(type))
     {
-        code += tab + valuetype->Allocation(value) + "\n";
+        allocation += tab + valuetype->Allocation(value) + "\n";
     }
     else if (auto arraytype = std::dynamic_pointer_cast<ArrayType>(type))
     {
         if (has_value)
         {
-            code += tab + arraytype->Allocation(literal) + "\n";
-            if (arraytype->Width() > literal.size() + 1)
-                code += tab + ArrayType(arraytype->underlying_type,
-                    arraytype->Width() - literal.size() - 1).Allocation() + "\n";
+            allocation += tab + arraytype->Allocation(literal) + "\n";
+            size_t length = StringLiteral::Length(literal);
+            if (arraytype->Width() > length + 1)
+                allocation += tab + ArrayType(arraytype->underlying_type,
+                    arraytype->Width() - length - 1).Allocation() + "\n";
         }
         else
-            code += tab + arraytype->Allocation() + "\n";
+            allocation += tab + arraytype->Allocation() + "\n";
     }
     else
         assert(false); // must not happen
 
-    return code + "\n";
+    // small variables are laid out one after another, each aligned to its elements, where a 16 bit
+    // offset from $gp reaches them
+    int width = type->Width();
+    int alignment = is_array_type(type) ? as_array_type(type)->underlying_type->Width() : width;
+    int offset = (ctx.small_data_size + alignment - 1) / alignment * alignment;
+    if (width <= ctx.options.small_data_limit && offset + width <= 32768)
+    {
+        ctx.DeclareField(FieldSymbol(name, type, location, offset));
+        if (offset > ctx.small_data_size)
+            ctx.small_data += tab + ".space " + std::to_string(offset - ctx.small_data_size) + "\n";
+        ctx.small_data += name + ":\n" + allocation;
+        ctx.small_data_size = offset + width;
+        return Code();
+    }
+
+    ctx.DeclareField(FieldSymbol(name, type, location));
+
+    Code code;
+    if (ctx.current_section != "data")
+    {
+        ctx.current_section = "data";
+        code += ".data\n";
+    }
+    return code + name + ":\n" + allocation + "\n";
+}
+
+// turns the generated code of a function into IR, runs it through SSA form
+// and allocates its registers; shrink_wrap prepares the body for StackFrame::Wrap
+// size is set to the number of instructions of the allocated body
+static Code LowerFunction(GlobalContext& ctx, const string& name, const Code& code, RegisterAllocator& allocator,
+    bool shrink_wrap, int& size)
+{
+    FunctionBody ir(code);
+    ir.ConstructSSA();
+
+    // callers mask the char arguments they pass
+    map<string, unsigned> arguments;
+    auto symbol = std::dynamic_pointer_cast<FunctionSymbol>(ctx[name]);
+    for (size_t i = 0; symbol && i < symbol->param_types.size(); i++)
+        if (*symbol->param_types[i] == *char_type)
+            arguments["$a" + std::to_string(i)] = 0xffffff00u;
+    EliminateRedundantMasks(ir, arguments);
+
+    NumberValues(ir);
+    HoistLoopInvariants(ir);
+    EliminateBoundsChecks(ir);
+    ReduceStrength(ir);
+    if (shrink_wrap)
+        SplitAtFrameSetup(ir);
+
+    if (ctx.options.ir_output != nullptr)
+        *ctx.options.ir_output << ir.Dump(name);
+
+    ir.DestructSSA();
+    Code allocated_code = allocator.Allocate(ir);
+    if (auto model = PipelineModel::Find(ctx.options.pipeline))
+    {
+        ScheduleInstructions(ir, *model);
+        allocated_code = ir.ToCode();
+    }
+
+    size = 0;
+    for (auto& block : ir.blocks)
+        size += block.instructions.size();
+    return allocated_code;
 }
 
 Code FunctionDefinition::Compile(GlobalContext& ctx)
@@ -443,9 +1451,6 @@ Code FunctionDefinition::Compile(GlobalContext& ctx)
     auto symbol = ctx.DeclareFunction(FunctionSymbol(name, type, param_types, location));
 
     FunctionContext fctx(ctx, *symbol);
-    
-    fctx.DeclareParameter("$saved_ra", int_type, location);
-    fctx.DeclareParameter("$saved_fp", int_type, location);
 
     for (auto p : params)
         fctx.DeclareParameter(p->name, p->type, p->location);
@@ -458,26 +1463,25 @@ Code FunctionDefinition::Compile(GlobalContext& ctx)
     }
     code += name + ":\n";
 
-    Code body_code = body->Compile(fctx);
+    Code entry_code;
+    for (size_t i = 0; i < params.size(); i++)
+        entry_code += fctx[params[i]->name]->SaveValue("$a" + std::to_string(i));
 
-    // prolouge
-    code += tab + "addu $sp, $sp, " + std::to_string(-*fctx.stack_depth) + "\n";
-    code += fctx["$saved_ra"]->SaveValue("$ra");
-    code += fctx["$saved_fp"]->SaveValue("$fp");
-    code += tab + "move $fp, $sp\n";
+    Code body_code = body->Compile(fctx);
+    if (fctx.tail_recursive)
+        entry_code += fctx.start_label + ":\n";
 
-    for (size_t i = 0; i < params.size(); i++)
-        code += fctx[params[i]->name]->SaveValue("$a" + std::to_string(i));
+    RegisterAllocator allocator(*fctx.stack_depth);
+    int size;
+    Code allocated_code = LowerFunction(ctx, name, entry_code + body_code, allocator, true, size);
 
-    code += body_code;
+    // later calls may compile the body again in their place
+    if (ctx.recursive_functions.count(name) == 0)
+        ctx.inline_candidates[name] = std::make_pair(this, size);
 
-    // epilouge
-    code += fctx.epilouge_label + ":\n";
-    code += tab + "move $sp, $fp\n";
-    code += fctx["$saved_ra"]->LoadValue("$ra");
-    code += fctx["$saved_fp"]->LoadValue("$fp");
-    code += tab + "addu $sp, $sp, " + std::to_string(*fctx.stack_depth) + "\n";
-    code += tab + "jr $ra\n";
+    // the frame is addressed from $sp and its size is fixed, so $fp is left alone
+    StackFrame frame(allocator.frame_size, allocator.saved_registers);
+    code += frame.Wrap(allocated_code, fctx.epilouge_label);
 
     return code + "\n";
 }
@@ -500,68 +1504,153 @@ Code MainFunctionDefinition::Compile(GlobalContext& ctx)
 
     Code body_code = body->Compile(fctx);
 
-    // prolouge
-    code += tab + "addu $sp, $sp, " + std::to_string(-*fctx.stack_depth) + "\n";
-    code += tab + "move $fp, $sp\n";
+    // main never returns, so callee-saved registers need not be preserved
+    RegisterAllocator allocator(*fctx.stack_depth);
+    int size;
+    Code allocated_code = LowerFunction(ctx, name, body_code, allocator, false, size);
 
-    code += body_code;
+    // prolouge; the slots of the saved registers, $ra among them, come after the locals and
+    // spill slots and are left out, as main saves none
+    int frame_size = allocator.saved_registers.empty() ? allocator.frame_size :
+        allocator.saved_registers.front().second;
+    if (frame_size > 0)
+        code += tab + "addu $sp, $sp, " + std::to_string(-frame_size) + "\n";
 
-    // epilouge
+    code += allocated_code;
+
+    // epilouge, exiting the program doesn't need the stack restored
     code += fctx.epilouge_label + ":\n";
-    code += tab + "move $sp, $fp\n";
-    code += tab + "addu $sp, $sp, " + std::to_string(*fctx.stack_depth) + "\n";
     if (*type == *void_type)
         code += tab + "j " + ctx["exit"]->name + "\n";
     else
+    {
+        // the value returned is the exit status
+        code += tab + "move $a0, $v0\n";
         code += tab + "j " + ctx["exit2"]->name + "\n";
+    }
 
     return code + "\n";
 }
 
-Code Program::Compile(function<void(const Location&, const string&, const string&)> printer)
+// the functions reached from main through the calls, jumps and addresses in their code, which
+// is given for every user function and routine of the runtime by name
+static set<string> ReachableFunctions(const map<string, string>& function_code)
+{
+    set<string> reached;
+    vector<string> worklist = {"main"};
+    while (!worklist.empty())
+    {
+        string name = worklist.back();
+        worklist.pop_back();
+        if (function_code.count(name) == 0 || !reached.insert(name).second)
+            continue;
+
+        std::stringstream lines(function_code.at(name));
+        string line;
+        while (std::getline(lines, line))
+        {
+            // the operands of an instruction, or the labels of a jump table
+            line = line.substr(0, line.find('#'));
+            std::replace_if(line.begin(), line.end(), [](char c) { return c == ',' || c == '(' || c == ')'; }, ' ');
+            std::stringstream words(line);
+            string word;
+            words >> word;
+            while (words >> word)
+                worklist.push_back(word);
+        }
+    }
+    return reached;
+}
+
+Code Program::Compile(function<void(const Location&, const string&, const string&)> printer,
+    const CompileOptions& options)
 {
     GlobalContext ctx;
     ctx.printer = printer;
+    ctx.options = options;
 
-    // define builtin function (syscalls)
+    // define builtin function (syscalls), compiled in place of their calls
     Location builtin_location;
     builtin_location.initialize(&builtin_filename);
-    ctx.DeclareFunction(FunctionSymbol("print_string", void_type, { char_pointer_type }, builtin_location));
-    ctx.DeclareFunction(FunctionSymbol("print_char", void_type, { char_type }, builtin_location));
-    ctx.DeclareFunction(FunctionSymbol("print_int", void_type, { int_type }, builtin_location));
+    ctx.DeclareFunction(FunctionSymbol("print_string", void_type, { char_pointer_type }, builtin_location, 4));
+    ctx.DeclareFunction(FunctionSymbol("print_char", void_type, { char_type }, builtin_location, 11));
+    ctx.DeclareFunction(FunctionSymbol("print_int", void_type, { int_type }, builtin_location, 1));
     
-    ctx.DeclareFunction(FunctionSymbol("read_string", void_type, { char_pointer_type, int_type }, builtin_location));
-    ctx.DeclareFunction(FunctionSymbol("read_char", char_type, { }, builtin_location));
-    ctx.DeclareFunction(FunctionSymbol("read_int", int_type, { }, builtin_location));
+    ctx.DeclareFunction(FunctionSymbol("read_string", void_type, { char_pointer_type, int_type }, builtin_location, 8));
+    ctx.DeclareFunction(FunctionSymbol("read_char", char_type, { }, builtin_location, 12));
+    ctx.DeclareFunction(FunctionSymbol("read_int", int_type, { }, builtin_location, 5));
 
-    ctx.DeclareFunction(FunctionSymbol("exit", void_type, { }, builtin_location));
-    ctx.DeclareFunction(FunctionSymbol("exit2", void_type, { int_type }, builtin_location));
+    ctx.DeclareFunction(FunctionSymbol("exit", void_type, { }, builtin_location, 10));
+    ctx.DeclareFunction(FunctionSymbol("exit2", void_type, { int_type }, builtin_location, 17));
     ctx.DeclareFunction(FunctionSymbol("$out_of_bounds_error", void_type, { int_type }, builtin_location));
 
-    ctx.current_section = "text";
-    Code code = ".data\n";
-    code += ".align 2 # word align\n\n";
-    code += ".text\n";
-    code += tab + "j main # entry point\n\n";
+    // the string routines called in place of the loops they replace, see CompileLoopIdiom
+    ctx.DeclareFunction(FunctionSymbol("$string_length", int_type, { char_pointer_type }, builtin_location));
+    ctx.DeclareFunction(FunctionSymbol("$string_copy", int_type, { char_pointer_type, char_pointer_type }, builtin_location));
+    ctx.DeclareFunction(FunctionSymbol("$string_prefix", int_type, { char_pointer_type, char_pointer_type }, builtin_location));
+    ctx.DeclareFunction(FunctionSymbol("$fill_bytes", void_type, { char_pointer_type, char_type, int_type }, builtin_location));
 
     for (auto d : definitions)
-        code += d->Compile(ctx);
+        d->FoldConstants();
 
-    
-    std::ifstream builtinsfile;
-    builtinsfile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-    try
+    // the data is gathered in front of the functions, which are only emitted if the program
+    // reaches them
+    Code data_code;
+    vector<string> function_names;
+    map<string, string> function_code;
+    for (auto d : definitions)
     {
-        builtinsfile.open(builtin_asm_filename);
+        auto definition = std::dynamic_pointer_cast<FunctionDefinition>(d);
+        ctx.current_section = definition ? "text" : "data";
+        if (!definition)
+        {
+            data_code += d->Compile(ctx);
+            continue;
+        }
+        std::stringstream text;
+        text << d->Compile(ctx);
+        function_names.push_back(definition->name);
+        function_code[definition->name] = text.str();
     }
-    catch (const std::ifstream::failure& er)
+    for (auto& routine : Runtime())
+        function_code[routine.name] = routine.text;
+    auto reached = ReachableFunctions(function_code);
+
+    // the small data section opens the word aligned data, $gp is pointed at it before main runs
+    Code code = ".data\n";
+    code += ".align 2 # word align\n\n";
+    if (ctx.small_data_size > 0)
     {
-        throw std::runtime_error("Unable to open file \"" + builtin_asm_filename + "\": " + er.what());
+        code += "$small_data:\n";
+        code += ctx.small_data;
+        code += ".align 2 # word align the data after it\n\n";
     }
+    code += data_code;
+    code += ".text\n";
+    if (ctx.small_data_size > 0)
+        code += tab + "la $gp, $small_data # small data base\n";
+    code += tab + "j main # entry point\n\n";
+    for (auto& name : function_names)
+        if (reached.count(name) > 0)
+            code += function_code[name];
+
+    // the routines of the runtime the program reaches, with their data
+    string runtime_data;
+    for (auto& routine : Runtime())
+        if (reached.count(routine.name) > 0)
+        {
+            code += routine.text + "\n";
+            runtime_data += routine.data;
+        }
+    if (!runtime_data.empty())
+        code += ".data\n" + runtime_data;
 
-    std::stringstream builtins_buffer;
-    builtins_buffer << builtinsfile.rdbuf();
-    code += builtins_buffer.str();
+    if (!ctx.inline_report.empty())
+    {
+        code += "\n";
+        for (auto& line : ctx.inline_report)
+            code += "# " + line + "\n";
+    }
 
     return code;
 }
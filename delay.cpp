@@ -0,0 +1,152 @@
+#include "delay.hpp"
+
+#include <sstream>
+
+
+// whether operand is an integer constant between lo and hi
+static bool Immediate(const string& operand, long long lo, long long hi)
+{
+    if (operand.empty() || is_register(operand))
+        return false;
+    try
+    {
+        size_t end;
+        long long value = std::stoll(operand, &end, 0);
+        return end == operand.size() && value >= lo && value <= hi;
+    }
+    catch (const std::logic_error&)
+    {
+        return false;
+    }
+}
+
+bool DelaySlotScheduler::SingleMachineInstruction(const Instruction& instruction)
+{
+    static const set<string> three_registers = {"addu", "subu", "and", "or", "xor", "nor", "slt", "sltu",
+        "sllv", "srlv", "srav"};
+    static const set<string> signed_immediate = {"addu", "addiu", "slt", "slti", "sltu", "sltiu"};
+    static const set<string> unsigned_immediate = {"and", "andi", "or", "ori", "xor", "xori"};
+    static const set<string> shifts = {"sll", "srl", "sra"};
+    static const set<string> memory = {"lw", "lh", "lhu", "lb", "lbu", "sw", "sh", "sb"};
+
+    auto& op = instruction.op;
+    auto& operands = instruction.operands;
+
+    if (operands.size() == 3 && is_register(operands[0]) && is_register(operands[1]))
+    {
+        if (is_register(operands[2]))
+            return three_registers.count(op) > 0;
+        return (signed_immediate.count(op) > 0 && Immediate(operands[2], -32768, 32767)) ||
+            (unsigned_immediate.count(op) > 0 && Immediate(operands[2], 0, 65535)) ||
+            (shifts.count(op) > 0 && Immediate(operands[2], 0, 31));
+    }
+
+    if (operands.size() == 2 && (op == "move" || op == "negu" || op == "not"))
+        return is_register(operands[0]) && is_register(operands[1]);
+
+    if (operands.size() == 2 && op == "li")
+        return is_register(operands[0]) && Immediate(operands[1], -32768, 65535);
+
+    // a load or store relative to a register; those of a label need the upper half of its address first
+    if (operands.size() == 2 && memory.count(op) > 0)
+    {
+        size_t open = operands[1].find('(');
+        string offset = operands[1].substr(0, open);
+        return open != string::npos && !Instruction::RegistersIn(operands[1]).empty() &&
+            (offset.empty() || Immediate(offset, -32768, 32767));
+    }
+    return false;
+}
+
+bool DelaySlotScheduler::Movable(const Instruction& instruction, const Instruction& transfer)
+{
+    // a load in the slot would reach the instruction at the target, which the assembler can't
+    // see, before its delay is over
+    if (!SingleMachineInstruction(instruction) || instruction.IsLoad())
+        return false;
+
+    // the registers the transfer reads, $ra written by a call before its slot runs, and $at
+    // used by branches the assembler expands into a comparison
+    set<string> read = {"$at"};
+    for (auto& operand : transfer.operands)
+        for (auto& reg : Instruction::RegistersIn(operand))
+            read.insert(reg);
+    if (transfer.IsCall())
+        read.insert("$ra");
+
+    for (auto& reg : instruction.Defs())
+        if (read.count(reg) > 0)
+            return false;
+    for (auto& reg : instruction.Uses())
+        if (reg == "$at" || (transfer.IsCall() && reg == "$ra"))
+            return false;
+    return true;
+}
+
+Code DelaySlotScheduler::Schedule(const Code& code)
+{
+    std::stringstream text;
+    text << code;
+
+    // the last instruction written, unless a label, a directive or a delay slot came after it
+    vector<string> lines;
+    size_t candidate = 0;
+    Instruction candidate_instruction;
+    bool has_candidate = false;
+
+    bool in_text = false;
+    string str;
+    while (std::getline(text, str))
+    {
+        string content = trim(str.substr(0, str.find('#')));
+        if (content.rfind(".text", 0) == 0)
+            in_text = true;
+        else if (content.rfind(".data", 0) == 0)
+            in_text = false;
+
+        if (!in_text || content.empty() || content[0] == '.' || is_label_line(content))
+        {
+            lines.push_back(str);
+            if (!content.empty())
+                has_candidate = false;
+            continue;
+        }
+
+        auto instruction = Instruction::Parse(str);
+        if (!instruction.IsTerminator() && !instruction.IsCall())
+        {
+            lines.push_back(str);
+            candidate = lines.size() - 1;
+            candidate_instruction = instruction;
+            has_candidate = true;
+            continue;
+        }
+
+        if (has_candidate && Movable(candidate_instruction, instruction))
+        {
+            string slot = lines[candidate];
+            lines.erase(lines.begin() + candidate);
+            lines.push_back(".set noreorder");
+            lines.push_back(str);
+            lines.push_back(slot);
+            lines.push_back(".set reorder");
+            filled++;
+        }
+        else
+        {
+            lines.push_back(str);
+            left++;
+        }
+        has_candidate = false;
+    }
+
+    Code scheduled;
+    for (auto& line : lines)
+        scheduled += line + "\n";
+    return scheduled;
+}
+
+string DelaySlotScheduler::Report() const
+{
+    return "# delay slots: " + std::to_string(filled) + " filled, " + std::to_string(left) + " left to the assembler\n";
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "ir.hpp"
+
+
+// fills the delay slots of the branches, jumps and calls of the final assembly of the program;
+// a slot gets the instruction in front of the transfer when that is a single machine instruction
+// the transfer doesn't depend on, such as an argument set up for a call, the stack pointer
+// restored for a return or a loop counter stepped before the jump back; only a filled transfer
+// and its slot are assembled with .set noreorder, the assembler keeps inserting the nops the
+// loads and hi and lo need everywhere else and fills the other slots itself
+class DelaySlotScheduler
+{
+public:
+    Code Schedule(const Code& code);
+
+    // number of slots filled with a moved instruction and left to the assembler
+    int filled = 0, left = 0;
+
+    // the counts as assembly comments
+    string Report() const;
+
+private:
+    // whether the assembler turns the instruction into exactly one machine instruction, so
+    // that it fits in a delay slot
+    static bool SingleMachineInstruction(const Instruction& instruction);
+
+    // whether the instruction may run after the transfer instead of before it
+    static bool Movable(const Instruction& instruction, const Instruction& transfer);
+};
@@ -1,5 +1,7 @@
 #include "driver.hpp"
 #include "scanner.hpp"
+#include "peephole.hpp"
+#include "delay.hpp"
 
 #include <iomanip>
 #include <fstream>
@@ -75,9 +77,44 @@ int Driver::Compile()
 
     astfile << ast->Tree();
 
+    CompileOptions options;
+    options.inline_threshold = inline_threshold;
+    options.unroll_factor = unroll_factor;
+    options.pipeline = pipeline;
+    options.small_data_limit = small_data_limit;
+
+    std::ofstream irfile;
+    if (!ir_filename.empty())
+    {
+        irfile.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+        try
+        {
+            irfile.open(ir_filename, std::ofstream::trunc);
+        }
+        catch (const std::ofstream::failure& er)
+        {
+            throw std::runtime_error("Unable to open file \"" + ir_filename + "\": " + er.what());
+        }
+        options.ir_output = &irfile;
+    }
+
     try
     {
-        outfile << ast->Compile(PrintError);
+        Code program = ast->Compile(PrintError, options);
+
+        PeepholeOptimizer peephole;
+        Code optimized = peephole.Optimize(program);
+        if (delay_slots)
+        {
+            DelaySlotScheduler scheduler;
+            outfile << scheduler.Schedule(optimized);
+            outfile << "\n" << peephole.Report() << scheduler.Report();
+        }
+        else
+        {
+            outfile << optimized;
+            outfile << "\n" << peephole.Report();
+        }
     }
     catch(const CompileError& er)
     {
@@ -23,6 +23,12 @@ public:
     std::string tokens_filename = "tokens.txt";
     std::string ast_filename = "ast.txt";
     std::string program_filename = "out.asm";
+    std::string ir_filename;  // empty to skip the IR dump
+    int inline_threshold = CompileOptions().inline_threshold;
+    int unroll_factor = CompileOptions().unroll_factor;
+    std::string pipeline = CompileOptions().pipeline;
+    int small_data_limit = CompileOptions().small_data_limit;
+    bool delay_slots = false;  // fill branch delay slots and assemble with .set noreorder
 
     shared_ptr<Program> ast;
 
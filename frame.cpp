@@ -0,0 +1,147 @@
+#include "frame.hpp"
+#include "optimizer.hpp"
+
+#include <algorithm>
+
+
+size_t StackFrame::SetupBlock(const FunctionBody& body, const vector<bool>& uses)
+{
+    auto idom = body.ComputeDominators();
+
+    size_t setup = body.blocks.size();
+    for (size_t b = 0; b < body.blocks.size(); b++)
+        if (uses[b])
+        {
+            if (setup == body.blocks.size())
+                setup = b;
+            while (!FunctionBody::Dominates(idom, setup, b))
+                setup = idom[setup];
+        }
+    if (setup == body.blocks.size())
+        return setup;
+
+    // the frame is set up once
+    for (auto& loop : body.FindLoops(idom))
+        while (loop.blocks.count(setup) > 0)
+            setup = idom[setup];
+
+    // and every path from there must leave through the epilogue
+    vector<bool> reached(body.blocks.size(), false);
+    vector<size_t> worklist = {setup};
+    while (!worklist.empty())
+    {
+        size_t b = worklist.back();
+        worklist.pop_back();
+        if (!FunctionBody::Dominates(idom, setup, b))
+            return 0;
+        for (auto s : body.blocks[b].successors)
+            if (!reached[s])
+            {
+                reached[s] = true;
+                worklist.push_back(s);
+            }
+    }
+    return setup;
+}
+
+vector<bool> StackFrame::FrameUses(const FunctionBody& body) const
+{
+    vector<bool> uses(body.blocks.size(), false);
+    for (size_t b = 0; b < body.blocks.size(); b++)
+        for (auto& instruction : body.blocks[b].instructions)
+        {
+            auto regs = instruction.Uses(), defs = instruction.Defs();
+            regs.insert(regs.end(), defs.begin(), defs.end());
+            for (auto& reg : regs)
+                if (reg == "$sp" || std::any_of(saved_registers.begin(), saved_registers.end(),
+                        [&reg](auto& saved) { return saved.first == reg; }))
+                    uses[b] = true;
+        }
+    return uses;
+}
+
+Code StackFrame::Wrap(const Code& body_code, const string& epilogue_label) const
+{
+    FunctionBody body(body_code);
+    size_t setup = size > 0 ? SetupBlock(body, FrameUses(body)) : body.blocks.size();
+    bool needed = setup < body.blocks.size();
+    auto idom = body.ComputeDominators();
+
+    vector<Instruction> epilogue;
+    if (needed)
+    {
+        vector<Instruction> prologue;
+        prologue.push_back(Instruction("addu", {"$sp", "$sp", std::to_string(-size)}));
+        for (auto [reg, offset] : saved_registers)
+        {
+            prologue.push_back(Instruction("sw", {reg, std::to_string(offset) + "($sp)"}));
+            epilogue.push_back(Instruction("lw", {reg, std::to_string(offset) + "($sp)"}));
+        }
+        epilogue.push_back(Instruction("addu", {"$sp", "$sp", std::to_string(size)}));
+
+        auto& instructions = body.blocks[setup].instructions;
+        instructions.insert(instructions.begin(), prologue.begin(), prologue.end());
+    }
+
+    for (size_t b = 0; b < body.blocks.size(); b++)
+    {
+        auto& instructions = body.blocks[b].instructions;
+
+        // tail calls jump out of the body, the frame is torn down in front of them
+        if (needed && FunctionBody::Dominates(idom, setup, b))
+        {
+            if (!instructions.empty() && instructions.back().IsJump() &&
+                instructions.back().Target() != epilogue_label &&
+                body.FindBlock(instructions.back().Target()) == body.blocks.size())
+                instructions.insert(instructions.end() - 1, epilogue.begin(), epilogue.end());
+            continue;
+        }
+
+        // blocks outside the frame return directly
+        for (auto& instruction : instructions)
+            if (instruction.IsJump() && instruction.Target() == epilogue_label)
+                instruction = Instruction("jr", {"$ra"});
+        if (needed && b + 1 == body.blocks.size() && (instructions.empty() || !instructions.back().IsTerminator()))
+            instructions.push_back(Instruction("jr", {"$ra"}));
+    }
+
+    Code code = body.ToCode();
+    code += epilogue_label + ":\n";
+    for (auto& instruction : epilogue)
+        code += instruction.Text() + "\n";
+    code += tab + "jr $ra\n";
+    return code;
+}
+
+
+void SplitAtFrameSetup(FunctionBody& body)
+{
+    // calls and stack variables need the frame, spills and callee-saved registers are not known yet
+    vector<bool> uses(body.blocks.size(), false);
+    for (size_t b = 0; b < body.blocks.size(); b++)
+        for (auto& instruction : body.blocks[b].instructions)
+        {
+            auto regs = instruction.Uses();
+            if (instruction.IsCall() || std::find(regs.begin(), regs.end(), "$sp") != regs.end())
+                uses[b] = true;
+        }
+
+    size_t setup = StackFrame::SetupBlock(body, uses);
+    if (setup == 0 || setup == body.blocks.size())
+        return;
+
+    // the values coming into the set up block are copied, uses from there on read the copies
+    body.ComputeLiveness();
+    auto idom = body.ComputeDominators();
+    auto& instructions = body.blocks[setup].instructions;
+    size_t position = body.blocks[setup].PhiCount();
+    for (auto& reg : body.blocks[setup].live_in)
+    {
+        string copy = body.NewRegister();
+        for (size_t b = 0; b < body.blocks.size(); b++)
+            if (FunctionBody::Dominates(idom, setup, b))
+                for (size_t i = b == setup ? position : 0; i < body.blocks[b].instructions.size(); i++)
+                    body.blocks[b].instructions[i].ReplaceUses(reg, copy);
+        instructions.insert(instructions.begin() + position, Instruction("move", {copy, reg}));
+    }
+}
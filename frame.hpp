@@ -0,0 +1,29 @@
+#pragma once
+
+#include "ir.hpp"
+
+
+// the stack frame of a register allocated function: its size and the registers saved in it
+class StackFrame
+{
+public:
+    StackFrame(int size, const vector<std::pair<string, int>>& saved_registers)
+        : size(size), saved_registers(saved_registers) {}
+
+    int size;
+    vector<std::pair<string, int>> saved_registers;
+
+    // the body with the code setting up the frame, followed by the epilogue at epilogue_label;
+    // the frame is set up in a block dominating every use of the stack, call and saved register
+    // (shrink-wrapping), so that paths returning before it don't touch memory; jumps to other
+    // functions (tail calls) restore the registers and the stack pointer first
+    Code Wrap(const Code& body_code, const string& epilogue_label) const;
+
+    // the nearest block dominating the blocks using the frame that is outside of loops and
+    // only leads to blocks it dominates, or blocks.size() if no block uses the frame
+    static size_t SetupBlock(const FunctionBody& body, const vector<bool>& uses);
+
+private:
+    // blocks of the body that need the frame to be set up
+    vector<bool> FrameUses(const FunctionBody& body) const;
+};
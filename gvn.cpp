@@ -0,0 +1,195 @@
+#include "optimizer.hpp"
+
+#include <algorithm>
+
+
+// operations whose operands may be swapped
+static const set<string> commutative = {"addu", "mul", "and", "or", "xor", "nor", "seq", "sne"};
+
+// a computed value and the instruction computing it, a load or a store for memory
+struct AvailableValue
+{
+    string reg;
+    size_t block, index;
+};
+
+class ValueNumbering
+{
+public:
+    ValueNumbering(FunctionBody& body) : body(body)
+    {
+        idom = body.ComputeDominators();
+        arrays = body.GlobalArrays();
+
+        children.resize(body.blocks.size());
+        for (size_t b = 1; b < body.blocks.size(); b++)
+            children[idom[b]].push_back(b);
+    }
+
+    void Run();
+
+private:
+    FunctionBody& body;
+    vector<size_t> idom;
+    vector<vector<size_t>> children;
+    set<string> arrays;
+
+    map<string, string> replacements;  // registers holding the same value as an earlier one
+    set<std::pair<size_t, size_t>> removed;
+
+    string Resolve(const string& reg) const
+    {
+        auto it = replacements.find(reg);
+        return it == replacements.end() ? reg : Resolve(it->second);
+    }
+
+    // the expression computed by an instruction, empty if it can't be reused
+    string Key(const Instruction& instruction) const;
+
+    // whether an instruction between two points of the body may change the memory
+    bool Clobbered(const MemoryLocation& location, const AvailableValue& from, size_t block, size_t index) const;
+    bool Clobbers(const Instruction& instruction, const MemoryLocation& location) const;
+
+    void Visit(size_t block, map<string, AvailableValue> available);
+};
+
+string ValueNumbering::Key(const Instruction& instruction) const
+{
+    // divisions trap in the same way the first time
+    static const set<string> division = {"div", "divu", "rem", "remu"};
+    if (!instruction.IsPure() && !instruction.IsLoad() && division.count(instruction.op) == 0)
+        return "";
+    if (instruction.operands.size() < 2 || !is_virtual_register(instruction.operands[0]))
+        return "";
+
+    // machine registers other than these change between instructions
+    Instruction resolved = instruction;
+    for (auto& reg : instruction.Uses())
+        if (is_virtual_register(reg))
+            resolved.ReplaceUses(reg, Resolve(reg));
+        else if (reg != "$zero" && reg != "$sp" && reg != "$gp")
+            return "";
+
+    vector<string> operands(resolved.operands.begin() + 1, resolved.operands.end());
+    if (commutative.count(instruction.op) > 0 && operands.size() == 2 && operands[1] < operands[0])
+        std::swap(operands[0], operands[1]);
+
+    string key = instruction.op;
+    for (auto& operand : operands)
+        key += " " + operand;
+    return key;
+}
+
+bool ValueNumbering::Clobbers(const Instruction& instruction, const MemoryLocation& location) const
+{
+    if (instruction.IsCall() || instruction.op == "syscall")
+        return true;
+    return instruction.IsStore() && MemoryLocation::Of(instruction.operands[1]).MayAlias(location, arrays);
+}
+
+bool ValueNumbering::Clobbered(const MemoryLocation& location, const AvailableValue& from,
+    size_t block, size_t index) const
+{
+    auto scan = [&](size_t b, size_t begin, size_t end)
+    {
+        auto& instructions = body.blocks[b].instructions;
+        for (size_t i = begin; i < end && i < instructions.size(); i++)
+            if (Clobbers(instructions[i], location))
+                return true;
+        return false;
+    };
+
+    if (from.block == block)
+        return scan(block, from.index + 1, index);
+    if (scan(from.block, from.index + 1, body.blocks[from.block].instructions.size()) || scan(block, 0, index))
+        return true;
+
+    // every block on a path between the two, found walking back from the later one up to the
+    // block dominating it; the later block itself is on such a path when it is in a loop
+    set<size_t> visited;
+    vector<size_t> worklist(body.blocks[block].predecessors.begin(), body.blocks[block].predecessors.end());
+    while (!worklist.empty())
+    {
+        size_t b = worklist.back();
+        worklist.pop_back();
+        if (b == from.block || !visited.insert(b).second)
+            continue;
+        if (scan(b, 0, body.blocks[b].instructions.size()))
+            return true;
+        worklist.insert(worklist.end(), body.blocks[b].predecessors.begin(), body.blocks[b].predecessors.end());
+    }
+    return false;
+}
+
+void ValueNumbering::Visit(size_t block, map<string, AvailableValue> available)
+{
+    auto& instructions = body.blocks[block].instructions;
+    for (size_t i = 0; i < instructions.size(); i++)
+    {
+        auto& instruction = instructions[i];
+
+        // a copy is replaced by the register it copies
+        if (instruction.op == "move" && is_virtual_register(instruction.operands[0]) &&
+            is_virtual_register(instruction.operands[1]))
+        {
+            replacements[instruction.operands[0]] = Resolve(instruction.operands[1]);
+            removed.insert(std::make_pair(block, i));
+            continue;
+        }
+
+        // a word stored is the word loaded back from the same place
+        if (instruction.op == "sw" && is_virtual_register(instruction.operands[0]))
+        {
+            available[Key(Instruction("lw", {"%0", instruction.operands[1]}))] =
+                AvailableValue{Resolve(instruction.operands[0]), block, i};
+            continue;
+        }
+
+        string key = Key(instruction);
+        if (key.empty())
+            continue;
+
+        auto it = available.find(key);
+        if (it != available.end() && !(instruction.IsLoad() &&
+            Clobbered(MemoryLocation::Of(instruction.operands[1]), it->second, block, i)))
+        {
+            replacements[instruction.operands[0]] = it->second.reg;
+            removed.insert(std::make_pair(block, i));
+            continue;
+        }
+        available[key] = AvailableValue{instruction.operands[0], block, i};
+    }
+
+    for (auto child : children[block])
+        Visit(child, available);
+}
+
+void ValueNumbering::Run()
+{
+    Visit(0, {});
+    if (replacements.empty())
+        return;
+
+    for (size_t b = 0; b < body.blocks.size(); b++)
+    {
+        auto& instructions = body.blocks[b].instructions;
+        vector<Instruction> kept;
+        for (size_t i = 0; i < instructions.size(); i++)
+        {
+            if (removed.count(std::make_pair(b, i)) > 0)
+                continue;
+            auto instruction = instructions[i];
+            for (auto& reg : instruction.Uses())
+                if (is_virtual_register(reg) && Resolve(reg) != reg)
+                    instruction.ReplaceUses(reg, Resolve(reg));
+            kept.push_back(instruction);
+        }
+        instructions = std::move(kept);
+    }
+}
+
+
+void NumberValues(FunctionBody& body)
+{
+    ValueNumbering(body).Run();
+}
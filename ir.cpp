@@ -0,0 +1,672 @@
+#include "ir.hpp"
+
+#include <sstream>
+#include <algorithm>
+
+
+string trim(const string& str)
+{
+    size_t begin = str.find_first_not_of(" \t");
+    if (begin == string::npos)
+        return "";
+    size_t end = str.find_last_not_of(" \t");
+    return str.substr(begin, end - begin + 1);
+}
+
+bool is_label_line(const string& line)
+{
+    if (line.size() < 2 || line.back() != ':')
+        return false;
+    return std::all_of(line.begin(), line.end() - 1,
+        [](char c) { return isalnum(c) || c == '_' || c == '$' || c == '.'; });
+}
+
+
+Instruction Instruction::Parse(const string& line)
+{
+    Instruction instruction;
+
+    string text = line;
+    size_t comment_start = text.find('#');
+    if (comment_start != string::npos)
+    {
+        instruction.comment = trim(text.substr(comment_start + 1));
+        text = text.substr(0, comment_start);
+    }
+
+    text = trim(text);
+    if (text.empty())
+        return instruction;
+
+    size_t op_end = text.find_first_of(" \t");
+    instruction.op = text.substr(0, op_end);
+    if (op_end == string::npos)
+        return instruction;
+
+    std::stringstream operands(text.substr(op_end));
+    string operand;
+    while (std::getline(operands, operand, ','))
+        instruction.operands.push_back(trim(operand));
+    return instruction;
+}
+
+bool Instruction::IsConditionalBranch() const
+{
+    static const set<string> branches = {
+        "beq", "bne", "blt", "bgt", "ble", "bge", "bltu", "bgtu", "bleu", "bgeu",
+        "beqz", "bnez", "bltz", "bgtz", "blez", "bgez"};
+    return branches.count(op) > 0;
+}
+
+bool Instruction::IsLoad() const
+{
+    return op == "lw" || op == "lb" || op == "lbu" || op == "lh" || op == "lhu";
+}
+
+bool Instruction::IsStore() const
+{
+    return op == "sw" || op == "sb" || op == "sh";
+}
+
+bool Instruction::IsPure() const
+{
+    static const set<string> pure = {
+        "li", "la", "lui", "move", "addu", "addiu", "subu", "negu", "mul", "and", "andi", "or", "ori",
+        "xor", "xori", "nor", "not", "sll", "sllv", "srl", "srlv", "sra", "srav",
+        "slt", "slti", "sltu", "sltiu", "seq", "sne", "sge", "sgeu", "sgt", "sgtu", "sle", "sleu"};
+    return pure.count(op) > 0;
+}
+
+string Instruction::Target() const
+{
+    if ((IsJump() || IsConditionalBranch() || op == "jal") && !operands.empty())
+        return operands.back();
+    return "";
+}
+
+void Instruction::SetTarget(const string& label)
+{
+    assert(IsJump() || IsConditionalBranch() || op == "jal");
+    operands.back() = label;
+}
+
+bool Instruction::DefinesFirstOperand() const
+{
+    static const set<string> non_defining = {
+        "sw", "sb", "sh", "b", "j", "jal", "jalr", "jr", "syscall", "nop", "break",
+        "mult", "multu", "mthi", "mtlo", "teq", "tne", "tge", "tgeu", "tlt", "tltu"};
+
+    if (IsComment() || operands.empty() || non_defining.count(op) > 0 || IsConditionalBranch())
+        return false;
+    // the two operand forms of division only write hi and lo
+    if ((op == "div" || op == "divu") && operands.size() == 2)
+        return false;
+    return true;
+}
+
+vector<string> Instruction::RegistersIn(const string& operand)
+{
+    if (is_register(operand))
+        return {operand};
+
+    size_t open = operand.find('('), close = operand.find(')');
+    if (open != string::npos && close != string::npos && close > open)
+    {
+        string base = operand.substr(open + 1, close - open - 1);
+        if (is_register(base))
+            return {base};
+    }
+    return {};
+}
+
+vector<string> Instruction::Uses() const
+{
+    vector<string> uses;
+    for (size_t i = DefinesFirstOperand() ? 1 : 0; i < operands.size(); i++)
+        for (auto reg : RegistersIn(operands[i]))
+            uses.push_back(reg);
+
+    if (op == "jal" || op == "jalr")
+        uses.insert(uses.end(), {"$a0", "$a1", "$a2", "$a3", "$sp"});
+    else if (IsReturn())
+        uses.insert(uses.end(), {"$v0", "$v1", "$sp"});
+    else if (op == "syscall")
+        uses.insert(uses.end(), {"$v0", "$a0", "$a1", "$a2"});
+    else if (op == "mfhi")
+        uses.push_back("$hi");
+    else if (op == "mflo")
+        uses.push_back("$lo");
+    return uses;
+}
+
+vector<string> Instruction::Defs() const
+{
+    vector<string> defs;
+    if (DefinesFirstOperand())
+        defs.push_back(operands[0]);
+
+    if (op == "jal" || op == "jalr")
+        defs.insert(defs.end(), {"$ra", "$v0", "$v1", "$a0", "$a1", "$a2", "$a3",
+            "$t0", "$t1", "$t2", "$t3", "$t4", "$t5", "$t6", "$t7", "$t8", "$t9", "$hi", "$lo"});
+    else if (op == "syscall")
+        defs.push_back("$v0");
+    else if (op == "mult" || op == "multu" || op == "div" || op == "divu" || op == "mul" || op == "rem" || op == "remu")
+        defs.insert(defs.end(), {"$hi", "$lo"});
+    else if (op == "mthi")
+        defs.push_back("$hi");
+    else if (op == "mtlo")
+        defs.push_back("$lo");
+    return defs;
+}
+
+string Instruction::ReplaceRegister(const string& operand, const string& from, const string& to)
+{
+    if (operand == from)
+        return to;
+
+    size_t open = operand.find('('), close = operand.find(')');
+    if (open != string::npos && close != string::npos && operand.substr(open + 1, close - open - 1) == from)
+        return operand.substr(0, open + 1) + to + operand.substr(close);
+    return operand;
+}
+
+void Instruction::ReplaceUses(const string& from, const string& to)
+{
+    for (size_t i = DefinesFirstOperand() ? 1 : 0; i < operands.size(); i++)
+        operands[i] = ReplaceRegister(operands[i], from, to);
+}
+
+void Instruction::ReplaceDefs(const string& from, const string& to)
+{
+    if (DefinesFirstOperand() && operands[0] == from)
+        operands[0] = to;
+}
+
+void Instruction::RenameRegister(const string& from, const string& to)
+{
+    for (auto& operand : operands)
+        operand = ReplaceRegister(operand, from, to);
+}
+
+string Instruction::Text() const
+{
+    if (IsComment())
+        return tab + "# " + comment;
+
+    string text = tab + op;
+    for (size_t i = 0; i < operands.size(); i++)
+        text += (i == 0 ? " " : ", ") + operands[i];
+    if (!comment.empty())
+        text += " # " + comment;
+    return text;
+}
+
+
+MemoryLocation MemoryLocation::Of(const string& operand)
+{
+    size_t open = operand.find('(');
+    string offset = operand.substr(0, open);
+    if (!offset.empty() && !isdigit(offset[0]) && offset[0] != '-')
+        return {Global, offset};
+    // only variables are reached directly from $gp, arrays in the small data section through a register
+    if (open != string::npos && operand.substr(open) == "($gp)")
+        return {Global, operand};
+    if (open != string::npos && operand.substr(open) == "($sp)")
+        return {Stack, ""};
+    return {Indirect, ""};
+}
+
+bool MemoryLocation::MayAlias(const MemoryLocation& other, const set<string>& arrays) const
+{
+    if (kind == Global && other.kind == Global)
+        return name == other.name;
+    if (kind == Global || other.kind == Global)
+    {
+        auto& global = kind == Global ? *this : other;
+        return (kind == Indirect || other.kind == Indirect) && arrays.count(global.name) > 0;
+    }
+    return true;
+}
+
+
+size_t BasicBlock::PhiCount() const
+{
+    size_t count = 0;
+    while (count < instructions.size() && instructions[count].IsPhi())
+        count++;
+    return count;
+}
+
+
+FunctionBody::FunctionBody(const Code& code)
+{
+    std::stringstream text;
+    text << code;
+
+    blocks.emplace_back();
+    bool block_ended = false;
+    bool in_data = false;
+    string table;
+
+    string line;
+    while (std::getline(text, line))
+    {
+        line = trim(line);
+        if (line.empty())
+            continue;
+
+        // jump tables, the only data a function body has
+        if (line.rfind(".data", 0) == 0 || line.rfind(".text", 0) == 0)
+        {
+            in_data = line[1] == 'd';
+            continue;
+        }
+        if (in_data)
+        {
+            if (is_label_line(line))
+                table = line.substr(0, line.size() - 1);
+            else if (line.rfind(".word", 0) == 0)
+            {
+                std::stringstream labels(line.substr(5));
+                string label;
+                while (std::getline(labels, label, ','))
+                    jump_tables[table].push_back(trim(label));
+            }
+            continue;
+        }
+
+        if (is_label_line(line))
+        {
+            string label = line.substr(0, line.size() - 1);
+            if (blocks.back().label.empty() && blocks.back().instructions.empty())
+                blocks.back().label = label;
+            else
+                blocks.emplace_back(label);
+            block_ended = false;
+            continue;
+        }
+
+        if (block_ended)
+        {
+            blocks.emplace_back();
+            block_ended = false;
+        }
+
+        blocks.back().instructions.push_back(Instruction::Parse(line));
+        block_ended = blocks.back().instructions.back().IsTerminator();
+
+        for (auto& operand : blocks.back().instructions.back().operands)
+            for (auto& reg : Instruction::RegistersIn(operand))
+                if (is_virtual_register(reg))
+                    register_count = std::max(register_count, std::stoi(reg.substr(1)));
+    }
+
+    BuildControlFlowGraph();
+}
+
+set<string> FunctionBody::GlobalArrays() const
+{
+    set<string> arrays;
+    for (auto& block : blocks)
+        for (auto& instruction : block.instructions)
+            if (instruction.IsLoad() || instruction.IsStore() || instruction.op == "la")
+            {
+                // indexed by a register, unlike a variable of the small data section named by its address
+                auto location = MemoryLocation::Of(instruction.operands[1]);
+                bool indexed = instruction.operands[1].find('(') != string::npos &&
+                    location.name != instruction.operands[1];
+                if (location.kind == MemoryLocation::Global && (instruction.op == "la" || indexed))
+                    arrays.insert(location.name);
+            }
+    return arrays;
+}
+
+size_t FunctionBody::FindBlock(const string& label) const
+{
+    for (size_t i = 0; i < blocks.size(); i++)
+        if (blocks[i].label == label)
+            return i;
+    return blocks.size();
+}
+
+vector<string> FunctionBody::IndirectTargets(size_t block) const
+{
+    // the table the jump register is loaded from, any table if it can't be found
+    auto& instructions = blocks[block].instructions;
+    auto jump = std::find_if(instructions.rbegin(), instructions.rend(),
+        [](const Instruction& in) { return in.IsIndirectJump(); });
+    string reg = jump->operands[0];
+    for (auto it = jump + 1; it != instructions.rend(); ++it)
+    {
+        auto defs = it->Defs();
+        if (std::find(defs.begin(), defs.end(), reg) == defs.end())
+            continue;
+        if (it->op == "lw")
+        {
+            string address = it->operands[1];
+            auto table = jump_tables.find(address.substr(0, address.find('(')));
+            if (table != jump_tables.end())
+                return table->second;
+        }
+        break;
+    }
+
+    vector<string> targets;
+    for (auto& [label, labels] : jump_tables)
+        targets.insert(targets.end(), labels.begin(), labels.end());
+    return targets;
+}
+
+void FunctionBody::BuildControlFlowGraph()
+{
+    for (auto& block : blocks)
+    {
+        block.successors.clear();
+        block.predecessors.clear();
+    }
+
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+        auto& instructions = blocks[i].instructions;
+        auto last = std::find_if(instructions.rbegin(), instructions.rend(),
+            [](const Instruction& in) { return !in.IsComment(); });
+
+        bool falls_through = true;
+        if (last != instructions.rend() && last->IsIndirectJump())
+        {
+            for (auto& label : IndirectTargets(i))
+            {
+                size_t target = FindBlock(label);
+                if (target < blocks.size() &&
+                    std::find(blocks[i].successors.begin(), blocks[i].successors.end(), target) ==
+                        blocks[i].successors.end())
+                    blocks[i].successors.push_back(target);
+            }
+            falls_through = false;
+        }
+        else if (last != instructions.rend() && last->IsTerminator())
+        {
+            size_t target = last->IsReturn() ? blocks.size() : FindBlock(last->Target());
+            if (target < blocks.size())
+                blocks[i].successors.push_back(target);
+            falls_through = last->IsConditionalBranch();
+        }
+
+        if (falls_through && i + 1 < blocks.size() &&
+            std::find(blocks[i].successors.begin(), blocks[i].successors.end(), i + 1) == blocks[i].successors.end())
+            blocks[i].successors.push_back(i + 1);
+
+        for (auto s : blocks[i].successors)
+            blocks[s].predecessors.push_back(i);
+    }
+}
+
+void FunctionBody::ComputeLiveness()
+{
+    // upward exposed uses and definitions of each block
+    vector<set<string>> uses(blocks.size()), defs(blocks.size());
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+        for (auto& instruction : blocks[i].instructions)
+        {
+            if (instruction.IsPhi())
+            {
+                defs[i].insert(instruction.operands[0]);
+                continue;
+            }
+
+            for (auto& reg : instruction.Uses())
+                if (is_virtual_register(reg) && defs[i].count(reg) == 0)
+                    uses[i].insert(reg);
+            for (auto& reg : instruction.Defs())
+                if (is_virtual_register(reg))
+                    defs[i].insert(reg);
+        }
+        blocks[i].live_in.clear();
+        blocks[i].live_out.clear();
+    }
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (size_t i = blocks.size(); i-- > 0;)
+        {
+            auto& block = blocks[i];
+
+            set<string> live_out;
+            for (auto s : block.successors)
+            {
+                live_out.insert(blocks[s].live_in.begin(), blocks[s].live_in.end());
+
+                size_t index = std::find(blocks[s].predecessors.begin(), blocks[s].predecessors.end(), i) -
+                    blocks[s].predecessors.begin();
+                for (size_t k = 0; k < blocks[s].PhiCount(); k++)
+                {
+                    auto& reg = blocks[s].instructions[k].operands[index + 1];
+                    if (is_virtual_register(reg))
+                        live_out.insert(reg);
+                }
+            }
+
+            set<string> live_in = uses[i];
+            for (auto& reg : live_out)
+                if (defs[i].count(reg) == 0)
+                    live_in.insert(reg);
+
+            if (live_in != block.live_in || live_out != block.live_out)
+            {
+                block.live_in = std::move(live_in);
+                block.live_out = std::move(live_out);
+                changed = true;
+            }
+        }
+    }
+}
+
+void FunctionBody::RemoveUnreachableBlocks()
+{
+    vector<bool> reachable(blocks.size(), false);
+    vector<size_t> worklist = {0};
+    reachable[0] = true;
+    while (!worklist.empty())
+    {
+        size_t b = worklist.back();
+        worklist.pop_back();
+        for (auto s : blocks[b].successors)
+            if (!reachable[s])
+            {
+                reachable[s] = true;
+                worklist.push_back(s);
+            }
+    }
+
+    if (std::all_of(reachable.begin(), reachable.end(), [](bool r) { return r; }))
+        return;
+
+    vector<BasicBlock> kept;
+    for (size_t i = 0; i < blocks.size(); i++)
+        if (reachable[i])
+            kept.push_back(std::move(blocks[i]));
+    blocks = std::move(kept);
+
+    // the tables of the switches removed with them, whose labels are gone
+    set<string> loaded;
+    for (auto& block : blocks)
+        for (auto& instruction : block.instructions)
+            for (auto& operand : instruction.operands)
+                loaded.insert(operand.substr(0, operand.find('(')));
+    for (auto it = jump_tables.begin(); it != jump_tables.end();)
+        it = loaded.count(it->first) > 0 ? std::next(it) : jump_tables.erase(it);
+
+    BuildControlFlowGraph();
+}
+
+vector<size_t> FunctionBody::ComputeDominators() const
+{
+    // reverse postorder of the blocks reachable from the entry
+    vector<size_t> order;
+    vector<bool> visited(blocks.size(), false);
+    vector<std::pair<size_t, size_t>> stack = {{0, 0}};
+    visited[0] = true;
+    while (!stack.empty())
+    {
+        auto& [b, next] = stack.back();
+        if (next < blocks[b].successors.size())
+        {
+            size_t s = blocks[b].successors[next++];
+            if (!visited[s])
+            {
+                visited[s] = true;
+                stack.push_back(std::make_pair(s, 0));
+            }
+        }
+        else
+        {
+            order.push_back(b);
+            stack.pop_back();
+        }
+    }
+    std::reverse(order.begin(), order.end());
+
+    vector<size_t> position(blocks.size(), blocks.size());
+    for (size_t i = 0; i < order.size(); i++)
+        position[order[i]] = i;
+
+    // iterative algorithm of Cooper, Harvey and Kennedy
+    vector<size_t> idom(blocks.size(), blocks.size());
+    idom[0] = 0;
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (size_t i = 1; i < order.size(); i++)
+        {
+            size_t b = order[i];
+            size_t new_idom = blocks.size();
+            for (auto p : blocks[b].predecessors)
+            {
+                if (idom[p] == blocks.size())
+                    continue;
+                if (new_idom == blocks.size())
+                {
+                    new_idom = p;
+                    continue;
+                }
+
+                size_t x = p, y = new_idom;
+                while (x != y)
+                {
+                    while (position[x] > position[y])
+                        x = idom[x];
+                    while (position[y] > position[x])
+                        y = idom[y];
+                }
+                new_idom = x;
+            }
+
+            if (idom[b] != new_idom)
+            {
+                idom[b] = new_idom;
+                changed = true;
+            }
+        }
+    }
+    return idom;
+}
+
+bool FunctionBody::Dominates(const vector<size_t>& idom, size_t a, size_t b)
+{
+    while (b != a && b != 0)
+        b = idom[b];
+    return b == a;
+}
+
+vector<Loop> FunctionBody::FindLoops(const vector<size_t>& idom) const
+{
+    map<size_t, Loop> loops;
+    for (size_t t = 0; t < blocks.size(); t++)
+        for (auto h : blocks[t].successors)
+            if (Dominates(idom, h, t))
+            {
+                auto& loop = loops[h];
+                loop.header = h;
+                loop.latches.push_back(t);
+                loop.blocks.insert(h);
+
+                // the blocks reaching the latch without going through the header
+                vector<size_t> worklist = {t};
+                while (!worklist.empty())
+                {
+                    size_t b = worklist.back();
+                    worklist.pop_back();
+                    if (!loop.blocks.insert(b).second)
+                        continue;
+                    for (auto p : blocks[b].predecessors)
+                        worklist.push_back(p);
+                }
+            }
+
+    vector<Loop> result;
+    for (auto& [header, loop] : loops)
+        result.push_back(loop);
+    std::stable_sort(result.begin(), result.end(),
+        [](const Loop& a, const Loop& b) { return a.blocks.size() < b.blocks.size(); });
+    return result;
+}
+
+Code FunctionBody::ToCode() const
+{
+    Code code;
+    for (auto& block : blocks)
+    {
+        if (!block.label.empty())
+            code += block.label + ":\n";
+        for (auto& instruction : block.instructions)
+            code += instruction.Text() + "\n";
+    }
+
+    if (!jump_tables.empty())
+    {
+        code += ".data\n";
+        for (auto& [label, labels] : jump_tables)
+        {
+            code += label + ":\n";
+            code += tab + ".word ";
+            for (size_t i = 0; i < labels.size(); i++)
+                code += (i == 0 ? "" : ", ") + labels[i];
+            code += "\n";
+        }
+        code += ".text\n";
+    }
+    return code;
+}
+
+string FunctionBody::Dump(const string& name) const
+{
+    auto list = [](const vector<size_t>& indices)
+    {
+        string str;
+        for (auto i : indices)
+            str += " b" + std::to_string(i);
+        return str;
+    };
+
+    string str = "function " + name + "\n";
+    for (size_t i = 0; i < blocks.size(); i++)
+    {
+        auto& block = blocks[i];
+        str += "b" + std::to_string(i) + (block.label.empty() ? "" : " " + block.label) + ":";
+        str += "  # pred" + list(block.predecessors) + ", succ" + list(block.successors) + "\n";
+        for (auto& instruction : block.instructions)
+            str += instruction.Text() + "\n";
+    }
+    for (auto& [label, labels] : jump_tables)
+    {
+        str += "table " + label + ":";
+        for (auto& l : labels)
+            str += " " + l;
+        str += "\n";
+    }
+    return str + "\n";
+}
@@ -0,0 +1,201 @@
+#pragma once
+
+#include "translation.hpp"
+
+
+// virtual registers are written as %1, %2, ... and only exist before register allocation
+inline bool is_virtual_register(const string& operand)
+{
+    return operand.size() > 1 && operand[0] == '%';
+}
+
+inline bool is_machine_register(const string& operand)
+{
+    static const set<string> registers = {
+        "$zero", "$at", "$v0", "$v1", "$a0", "$a1", "$a2", "$a3",
+        "$t0", "$t1", "$t2", "$t3", "$t4", "$t5", "$t6", "$t7", "$t8", "$t9",
+        "$s0", "$s1", "$s2", "$s3", "$s4", "$s5", "$s6", "$s7",
+        "$k0", "$k1", "$gp", "$sp", "$fp", "$ra", "$hi", "$lo"};
+    return registers.count(operand) > 0;
+}
+
+inline bool is_register(const string& operand)
+{
+    return is_virtual_register(operand) || is_machine_register(operand);
+}
+
+// removes leading and trailing spaces and tabs
+string trim(const string& str);
+
+// whether a line of assembly, without comment, is a label
+bool is_label_line(const string& line);
+
+
+// a single assembly instruction inside a function body
+class Instruction
+{
+public:
+    Instruction() {}
+
+    Instruction(const string& op, const vector<string>& operands = {})
+        : op(op), operands(operands) {}
+
+    string op;  // empty for comment-only lines
+    vector<string> operands;
+    string comment;
+
+    // parses one line of assembly, labels are handled by FunctionBody
+    static Instruction Parse(const string& line);
+
+    bool IsComment() const { return op.empty(); }
+    bool IsPhi() const { return op == "phi"; }
+    bool IsCall() const { return op == "jal" || op == "jalr"; }
+    bool IsReturn() const { return op == "jr" && !operands.empty() && operands[0] == "$ra"; }
+    bool IsJump() const { return op == "b" || op == "j"; }
+    bool IsIndirectJump() const { return op == "jr" && !IsReturn(); }  // through a jump table
+    bool IsConditionalBranch() const;
+    bool IsTerminator() const { return IsJump() || IsConditionalBranch() || IsReturn() || IsIndirectJump(); }
+    bool IsLoad() const;
+    bool IsStore() const;
+
+    // whether the instruction computes a register from its operands alone and can't trap
+    bool IsPure() const;
+
+    // label operand of branches, jumps and calls
+    string Target() const;
+    void SetTarget(const string& label);
+
+    // whether the first operand is written by the instruction
+    bool DefinesFirstOperand() const;
+
+    // registers read and written by the instruction, including implicit ones such as $ra for jal
+    vector<string> Uses() const;
+    vector<string> Defs() const;
+
+    void ReplaceUses(const string& from, const string& to);
+    void ReplaceDefs(const string& from, const string& to);
+    void RenameRegister(const string& from, const string& to);
+
+    string Text() const;
+
+    // registers appearing in an operand, e.g. the base register of 8($sp)
+    static vector<string> RegistersIn(const string& operand);
+
+private:
+    static string ReplaceRegister(const string& operand, const string& from, const string& to);
+};
+
+
+// the memory an address operand points into: a global by its name (its offset from $gp in the
+// small data section), a fixed slot of the stack, or an array reached through a register, which
+// may be any array
+struct MemoryLocation
+{
+    enum Kind { Global, Stack, Indirect } kind;
+    string name;
+
+    static MemoryLocation Of(const string& operand);
+
+    // whether writing one location may change the other; arrays are the globals used as arrays,
+    // the only globals reachable through a register
+    bool MayAlias(const MemoryLocation& other, const set<string>& arrays) const;
+};
+
+
+class BasicBlock
+{
+public:
+    BasicBlock(const string& label = "") : label(label) {}
+
+    string label;  // empty when the block is only entered by falling through
+    vector<Instruction> instructions;
+
+    vector<size_t> successors, predecessors;
+
+    // virtual registers live on entry and exit, see FunctionBody::ComputeLiveness
+    set<string> live_in, live_out;
+
+    // phi instructions are at the start of the block, their operands after the destination
+    // follow the order of predecessors
+    size_t PhiCount() const;
+};
+
+
+// a natural loop, entered through its header which dominates all of its blocks; the latches
+// are the blocks branching back to the header
+struct Loop
+{
+    size_t header;
+    set<size_t> blocks;
+    vector<size_t> latches;
+};
+
+
+// the instructions of a function body split into basic blocks, in layout order;
+// this is the three-address intermediate representation optimizations run on: every operation
+// reads and writes virtual registers, and between ConstructSSA and DestructSSA each virtual
+// register is written exactly once
+class FunctionBody
+{
+public:
+    FunctionBody(const Code& code);
+
+    vector<BasicBlock> blocks;
+
+    // tables of code addresses in the data section of the body, by label; an indirect jump
+    // goes to one of the labels of the table its target is loaded from
+    map<string, vector<string>> jump_tables;
+
+    // highest virtual register number in use
+    int register_count = 0;
+
+    string NewRegister()
+    {
+        return "%" + std::to_string(++register_count);
+    }
+
+    // fills in successors and predecessors from the branches ending each block
+    void BuildControlFlowGraph();
+
+    // labels an indirect jump ending the block may go to
+    vector<string> IndirectTargets(size_t block) const;
+
+    // computes live_in and live_out of virtual registers for every block; phi operands are
+    // live at the end of the corresponding predecessor, not at the start of the block
+    void ComputeLiveness();
+
+    // removes blocks that cannot be reached from the entry block
+    void RemoveUnreachableBlocks();
+
+    // immediate dominator of every block, the entry block is its own dominator
+    vector<size_t> ComputeDominators() const;
+
+    // whether block a dominates block b, given the immediate dominators
+    static bool Dominates(const vector<size_t>& idom, size_t a, size_t b);
+
+    // natural loops of the body, loops sharing a header are merged; inner loops come first
+    vector<Loop> FindLoops(const vector<size_t>& idom) const;
+
+    // renames virtual registers so that each one is written once, inserting phi instructions
+    // where different definitions meet
+    void ConstructSSA();
+
+    // removes phi instructions, merging the registers of a phi when their live ranges
+    // don't interfere and inserting copies otherwise
+    void DestructSSA();
+
+    // orders copies meant to happen at the same time so that none overwrites a register
+    // another one still reads
+    vector<Instruction> SequenceCopies(vector<Instruction> copies);
+
+    // globals accessed with an index or whose address is taken, which makes them arrays
+    set<string> GlobalArrays() const;
+
+    // index of the block with the given label, or blocks.size() if the label is outside the body
+    size_t FindBlock(const string& label) const;
+
+    Code ToCode() const;
+
+    // readable listing of the blocks, used for -emit-ir
+    string Dump(const string& name) const;
+};
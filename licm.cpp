@@ -0,0 +1,162 @@
+#include "optimizer.hpp"
+
+#include <algorithm>
+
+
+class LoopInvariantMotion
+{
+public:
+    LoopInvariantMotion(FunctionBody& body) : body(body)
+    {
+        idom = body.ComputeDominators();
+        loops = body.FindLoops(idom);
+        arrays = body.GlobalArrays();
+
+        for (size_t b = 0; b < body.blocks.size(); b++)
+            for (auto& instruction : body.blocks[b].instructions)
+                for (auto& reg : instruction.Defs())
+                    if (is_virtual_register(reg))
+                        definitions[reg] = b;
+    }
+
+    void Run();
+
+private:
+    FunctionBody& body;
+    vector<size_t> idom;
+    vector<Loop> loops;
+    map<string, size_t> definitions;  // block of the instruction writing each register
+    set<string> arrays;
+
+    // what the stores and calls of a loop may change
+    struct Writes
+    {
+        bool all = false;  // a call or system call, which may change any memory
+        vector<MemoryLocation> stores;
+    };
+
+    Writes FindWrites(const Loop& loop) const;
+
+    // the single block outside the loop entering it, which it falls through to or jumps to
+    // unconditionally; blocks.size() if there is none
+    size_t Preheader(const Loop& loop) const;
+
+    bool Invariant(const Loop& loop, const string& reg) const;
+    bool Hoistable(const Loop& loop, size_t block, const Instruction& instruction, const Writes& writes) const;
+};
+
+LoopInvariantMotion::Writes LoopInvariantMotion::FindWrites(const Loop& loop) const
+{
+    Writes writes;
+    for (auto b : loop.blocks)
+        for (auto& instruction : body.blocks[b].instructions)
+        {
+            if (instruction.IsCall() || instruction.op == "syscall")
+                writes.all = true;
+            else if (instruction.IsStore())
+                writes.stores.push_back(MemoryLocation::Of(instruction.operands[1]));
+        }
+    return writes;
+}
+
+size_t LoopInvariantMotion::Preheader(const Loop& loop) const
+{
+    vector<size_t> outside;
+    for (auto p : body.blocks[loop.header].predecessors)
+        if (loop.blocks.count(p) == 0)
+            outside.push_back(p);
+    if (outside.size() != 1 || body.blocks[outside[0]].successors.size() != 1)
+        return body.blocks.size();
+    return outside[0];
+}
+
+bool LoopInvariantMotion::Invariant(const Loop& loop, const string& reg) const
+{
+    // the stack pointer only moves in the prolouge and epilouge
+    if (reg == "$zero" || reg == "$sp" || reg == "$gp")
+        return true;
+    auto it = definitions.find(reg);
+    return is_virtual_register(reg) && it != definitions.end() && loop.blocks.count(it->second) == 0;
+}
+
+bool LoopInvariantMotion::Hoistable(const Loop& loop, size_t block, const Instruction& instruction,
+    const Writes& writes) const
+{
+    // the loop may not run the instruction at all, so it must not trap
+    if (!instruction.IsPure() && !instruction.IsLoad())
+        return false;
+
+    auto defs = instruction.Defs();
+    if (defs.empty() || !is_virtual_register(defs[0]) ||
+        std::any_of(defs.begin() + 1, defs.end(), [](auto& reg) { return reg != "$hi" && reg != "$lo"; }))
+        return false;
+
+    for (auto& reg : instruction.Uses())
+        if (!Invariant(loop, reg))
+            return false;
+
+    if (instruction.IsLoad())
+    {
+        auto location = MemoryLocation::Of(instruction.operands[1]);
+        if (writes.all || std::any_of(writes.stores.begin(), writes.stores.end(),
+            [&](auto& store) { return store.MayAlias(location, arrays); }))
+            return false;
+
+        // a global variable or a fixed stack slot can always be read, an array element only
+        // where the loop reads it on every entry, past the bounds check guarding it
+        auto& address = instruction.operands[1];
+        bool indexed = address.find('(') != string::npos && address.substr(address.find('(')) != "($gp)";
+        if (location.kind != MemoryLocation::Stack && indexed && block != loop.header)
+            return false;
+    }
+    return true;
+}
+
+void LoopInvariantMotion::Run()
+{
+    // inner loops come first, what leaves them may leave the outer loops next
+    for (auto& loop : loops)
+    {
+        size_t preheader = Preheader(loop);
+        if (preheader == body.blocks.size())
+            continue;
+
+        auto writes = FindWrites(loop);
+        auto& destination = body.blocks[preheader].instructions;
+
+        vector<size_t> order(loop.blocks.begin(), loop.blocks.end());
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (auto b : order)
+            {
+                auto& instructions = body.blocks[b].instructions;
+                for (size_t i = 0; i < instructions.size();)
+                {
+                    if (instructions[i].IsPhi() || !Hoistable(loop, b, instructions[i], writes))
+                    {
+                        i++;
+                        continue;
+                    }
+
+                    // in front of the jump into the loop, if any
+                    auto position = destination.end();
+                    if (!destination.empty() && destination.back().IsTerminator())
+                        position = destination.end() - 1;
+                    destination.insert(position, instructions[i]);
+
+                    definitions[instructions[i].Defs()[0]] = preheader;
+                    instructions.erase(instructions.begin() + i);
+                    changed = true;
+                }
+            }
+        }
+    }
+}
+
+
+void HoistLoopInvariants(FunctionBody& body)
+{
+    LoopInvariantMotion(body).Run();
+}
@@ -1,6 +1,7 @@
 #include <iostream>
 #include <string>
 #include "driver.hpp"
+#include "optimizer.hpp"
 
 // if _SCAN_ONLY is defined, parsing must be skipped
 #if _PARSE_ONLY
@@ -67,6 +68,76 @@ int main(int argc, char* argv[])
             }
         }
 
+        // output the intermediate representation to the specified file
+        else if (argv[i] == std::string("-emit-ir"))
+        {
+            i++;
+            if (i < argc)
+                driver.ir_filename = argv[i];
+            else
+            {
+                std::cerr << "Missing filename for argument -emit-ir" << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+
+        // limit the code growth of inlining a call, a negative value disables inlining
+        else if (argv[i] == std::string("-inline-threshold"))
+        {
+            i++;
+            if (i < argc)
+                driver.inline_threshold = std::atoi(argv[i]);
+            else
+            {
+                std::cerr << "Missing value for argument -inline-threshold" << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+
+        // copies of the body of counted for loops run per test, 1 disables unrolling
+        else if (argv[i] == std::string("-unroll-factor"))
+        {
+            i++;
+            if (i < argc)
+                driver.unroll_factor = std::atoi(argv[i]);
+            else
+            {
+                std::cerr << "Missing value for argument -unroll-factor" << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+
+        // the pipeline model instructions are scheduled for, none to leave their order alone
+        else if (argv[i] == std::string("-pipeline"))
+        {
+            i++;
+            if (i < argc && (argv[i] == std::string("none") || PipelineModel::Find(argv[i]) != nullptr))
+                driver.pipeline = argv[i];
+            else
+            {
+                std::cerr << "Missing or unknown pipeline model for argument -pipeline, "
+                    << "expected r3000, r4000 or none" << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+
+        // the largest global variable addressed relative to $gp, 0 to address all by their label
+        else if (argv[i] == std::string("-small-data-limit"))
+        {
+            i++;
+            if (i < argc)
+                driver.small_data_limit = std::atoi(argv[i]);
+            else
+            {
+                std::cerr << "Missing value for argument -small-data-limit" << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+
+        // fill branch delay slots instead of leaving them to the assembler
+        else if (argv[i] == std::string("-delay-slots"))
+            driver.delay_slots = true;
+
         // output filename
         else if (argv[i] == std::string("-o"))
         {
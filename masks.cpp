@@ -0,0 +1,165 @@
+#include "optimizer.hpp"
+
+
+// the bits of the registers of a body known to be zero; virtual registers get theirs from an
+// optimistic fixed point over the SSA form, every one starting with all bits zero and losing the
+// bits the instruction writing it may set, and machine registers from the instructions writing
+// them earlier in the same block
+class KnownBits
+{
+public:
+    KnownBits(FunctionBody& body, const map<string, unsigned>& arguments) : body(body), arguments(arguments) {}
+
+    void Run();
+
+private:
+    FunctionBody& body;
+    const map<string, unsigned>& arguments;
+
+    map<string, unsigned> zeros;    // of the virtual registers
+    map<string, unsigned> machine;  // of the machine registers, in the block being looked at
+
+    unsigned Zeros(const string& operand) const;
+
+    // the zero bits of the register the instruction writes first
+    unsigned Result(const Instruction& instruction) const;
+
+    // visits the instructions of a block in order, keeping track of the machine registers
+    void Walk(size_t block, const function<void(Instruction&)>& visit);
+};
+
+unsigned KnownBits::Zeros(const string& operand) const
+{
+    if (operand == "$zero")
+        return ~0u;
+    if (is_virtual_register(operand))
+    {
+        auto it = zeros.find(operand);
+        return it == zeros.end() ? 0 : it->second;
+    }
+    if (is_machine_register(operand))
+    {
+        auto it = machine.find(operand);
+        return it == machine.end() ? 0 : it->second;
+    }
+    if (operand.empty() || (!isdigit(operand[0]) && operand[0] != '-'))
+        return 0;
+    return ~unsigned(std::stoll(operand, nullptr, 0));
+}
+
+unsigned KnownBits::Result(const Instruction& instruction) const
+{
+    static const set<string> comparisons = {"slt", "sltu", "slti", "sltiu", "seq", "sne",
+        "sgt", "sgtu", "sge", "sgeu", "sle", "sleu"};
+
+    auto& op = instruction.op;
+    auto& ops = instruction.operands;
+
+    if (op == "li" || op == "move")
+        return Zeros(ops[1]);
+    if (op == "lbu")
+        return 0xffffff00u;
+    if (op == "lhu")
+        return 0xffff0000u;
+    if (comparisons.count(op) > 0)
+        return ~1u;
+    if (ops.size() == 3 && (op == "and" || op == "andi"))
+        return Zeros(ops[1]) | Zeros(ops[2]);
+    if (ops.size() == 3 && (op == "or" || op == "ori" || op == "xor" || op == "xori"))
+        return Zeros(ops[1]) & Zeros(ops[2]);
+    if (ops.size() == 3 && (op == "srl" || op == "sll") && !is_register(ops[2]))
+    {
+        int shift = std::stoi(ops[2], nullptr, 0) & 31;
+        if (op == "srl")
+            return (Zeros(ops[1]) >> shift) | ~(~0u >> shift);
+        return (Zeros(ops[1]) << shift) | ((1u << shift) - 1);
+    }
+    if (instruction.IsPhi())
+    {
+        unsigned result = ~0u;
+        for (size_t i = 1; i < ops.size(); i++)
+            result &= Zeros(ops[i]);
+        return result;
+    }
+    return 0;
+}
+
+void KnownBits::Walk(size_t block, const function<void(Instruction&)>& visit)
+{
+    // the arguments are only known on entry to the body, the entry block being no branch target
+    machine = block == 0 ? arguments : map<string, unsigned>();
+    for (auto& instruction : body.blocks[block].instructions)
+    {
+        visit(instruction);
+
+        auto defs = instruction.Defs();
+        for (size_t i = 0; i < defs.size(); i++)
+            if (is_machine_register(defs[i]))
+            {
+                if (i == 0 && instruction.DefinesFirstOperand())
+                    machine[defs[i]] = Result(instruction);
+                else
+                    machine.erase(defs[i]);
+            }
+    }
+}
+
+void KnownBits::Run()
+{
+    for (auto& block : body.blocks)
+        for (auto& instruction : block.instructions)
+            if (instruction.DefinesFirstOperand() && is_virtual_register(instruction.operands[0]))
+                zeros[instruction.operands[0]] = ~0u;
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (size_t b = 0; b < body.blocks.size(); b++)
+            Walk(b, [&](Instruction& instruction)
+            {
+                if (!instruction.DefinesFirstOperand() || !is_virtual_register(instruction.operands[0]))
+                    return;
+                unsigned& known = zeros[instruction.operands[0]];
+                unsigned result = known & Result(instruction);
+                if (result != known)
+                {
+                    known = result;
+                    changed = true;
+                }
+            });
+    }
+
+    // a mask clearing only bits already known to be zero is a copy, or nothing when in place
+    for (size_t b = 0; b < body.blocks.size(); b++)
+    {
+        auto& instructions = body.blocks[b].instructions;
+        set<size_t> removed;
+        size_t index = 0;
+        Walk(b, [&](Instruction& instruction)
+        {
+            auto& ops = instruction.operands;
+            if ((instruction.op == "and" || instruction.op == "andi") && ops.size() == 3 && !is_register(ops[2]) &&
+                (Zeros(ops[2]) & ~Zeros(ops[1])) == 0)
+            {
+                if (ops[0] == ops[1])
+                    removed.insert(index);
+                else
+                    instruction = Instruction("move", {ops[0], ops[1]});
+            }
+            index++;
+        });
+
+        vector<Instruction> kept;
+        for (size_t i = 0; i < instructions.size(); i++)
+            if (removed.count(i) == 0)
+                kept.push_back(instructions[i]);
+        instructions = std::move(kept);
+    }
+}
+
+
+void EliminateRedundantMasks(FunctionBody& body, const map<string, unsigned>& arguments)
+{
+    KnownBits(body, arguments).Run();
+}
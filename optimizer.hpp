@@ -0,0 +1,51 @@
+#pragma once
+
+#include "ir.hpp"
+
+
+// optimization passes over the SSA form of a function body, run from LowerFunction in codegen.cpp
+
+// replaces computations of a value an earlier instruction dominating them already computed,
+// and loads of memory no store or call changed since, with that value; copies between registers
+// are removed, their uses reading the copied register instead
+void NumberValues(FunctionBody& body);
+
+// removes masks such as the and with 0xff keeping a char value in range when the bits they clear
+// are known to be zero already, from loads of bytes, constants, comparisons and earlier masks;
+// arguments are the bits known to be zero in machine registers on entry to the body
+void EliminateRedundantMasks(FunctionBody& body, const map<string, unsigned>& arguments);
+
+// moves the computations of loops whose operands don't change inside the loop in front of it,
+// including loads of memory no store or call in the loop may change
+void HoistLoopInvariants(FunctionBody& body);
+
+// removes array bounds checks whose index is known to be in range, from the values loop counters
+// go through and from dominating checks, and checks the last iteration of simple counted loops
+// once in front of the loop instead of checking every iteration
+void EliminateBoundsChecks(FunctionBody& body);
+
+// replaces divisions and remainders by constants with shifts or multiplications by a reciprocal,
+// and multiplications by constants with shifts, additions and subtractions when cheaper
+void ReduceStrength(FunctionBody& body);
+
+// cycles from issuing an instruction to the first instruction able to use its result on some
+// pipeline; instructions the model doesn't list take one cycle
+struct PipelineModel
+{
+    map<string, int> latencies;
+
+    int Latency(const Instruction& instruction) const;
+
+    // the model with the given name, see CompileOptions::pipeline; null if there is none
+    static const PipelineModel* Find(const string& name);
+};
+
+// reorders the instructions of a register allocated body within stretches of blocks entered
+// only by falling through, so that independent instructions fill the cycles an instruction
+// waits for the result of a load, multiplication or division before it
+void ScheduleInstructions(FunctionBody& body, const PipelineModel& model);
+
+// copies the values live into the block the stack frame will be set up in (see StackFrame::Wrap)
+// into new registers there, so that values kept across calls in callee-saved registers are
+// only moved into them once the frame has saved the registers
+void SplitAtFrameSetup(FunctionBody& body);
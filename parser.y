@@ -50,6 +50,7 @@
     PLUS            "+"
     MULTIPLY        "*"
     DIVIDE          "/"
+    MODULO          "%"
     ASSIGN          "="
     LEFTPAREN       "("
     RIGHTPAREN      ")"
@@ -112,7 +113,7 @@
 %left "==" "!="
 %left "<" "<=" ">" ">="
 %left "+" "-";
-%left "*" "/";
+%left "*" "/" "%";
 %precedence UnaryPlus UnaryMinus "!" "~";
 
 
@@ -354,6 +355,7 @@ Expression
     | Expression "-" Expression { $$ = std::make_shared<BinaryValueExpression>("-", $1, $3); }
     | Expression "*" Expression { $$ = std::make_shared<BinaryValueExpression>("*", $1, $3); }
     | Expression "/" Expression { $$ = std::make_shared<BinaryValueExpression>("/", $1, $3); }
+    | Expression "%" Expression { $$ = std::make_shared<BinaryValueExpression>("%", $1, $3); }
     | "+" Expression %prec UnaryPlus { $$ = std::make_shared<UnaryValueExpression>("+", $2, @1); }
     | "-" Expression %prec UnaryMinus { $$ = std::make_shared<UnaryValueExpression>("-", $2, @1); }
 
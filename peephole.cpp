@@ -0,0 +1,198 @@
+#include "peephole.hpp"
+
+#include <sstream>
+
+
+PeepholeOptimizer::PeepholeOptimizer()
+{
+    rules = {
+        // move $x, $x
+        {"redundant move", 1, [](auto& w, auto&, auto&)
+        {
+            return w[0].op == "move" && w[0].operands[0] == w[0].operands[1];
+        }},
+
+        // b L ; L:
+        {"jump to next instruction", 1, [](auto& w, auto& next_labels, auto&)
+        {
+            return (w[0].IsJump() || w[0].IsConditionalBranch()) && next_labels.count(w[0].Target()) > 0;
+        }},
+
+        // addu $x, $y, 0  ->  move $x, $y
+        {"add of zero", 1, [](auto& w, auto&, auto& replacement)
+        {
+            static const set<string> ops = {"addu", "addiu", "subu", "or", "ori", "xor", "xori"};
+            if (ops.count(w[0].op) == 0 || w[0].operands.size() != 3 ||
+                (w[0].operands[2] != "0" && w[0].operands[2] != "$zero"))
+                return false;
+            if (w[0].operands[0] != w[0].operands[1])
+                replacement = {Instruction("move", {w[0].operands[0], w[0].operands[1]})};
+            return true;
+        }},
+
+        // b L ; <instruction without label>
+        {"unreachable after jump", 2, [](auto& w, auto&, auto& replacement)
+        {
+            if (!w[0].IsJump() && !w[0].IsReturn() && !w[0].IsIndirectJump())
+                return false;
+            replacement = {w[0]};
+            return true;
+        }},
+
+        // sw $x, A ; lw $y, A  ->  sw $x, A ; move $y, $x
+        {"store then load", 2, [](auto& w, auto&, auto& replacement)
+        {
+            if (w[0].op != "sw" || w[1].op != "lw" || w[0].operands[1] != w[1].operands[1])
+                return false;
+            replacement = {w[0]};
+            if (w[1].operands[0] != w[0].operands[0])
+                replacement.push_back(Instruction("move", {w[1].operands[0], w[0].operands[0]}));
+            return true;
+        }},
+
+        // lw $x, A ; sw $x, A  where A does not depend on $x
+        {"load then store", 2, [](auto& w, auto&, auto& replacement)
+        {
+            if (w[0].op != "lw" || w[1].op != "sw" || w[0].operands != w[1].operands)
+                return false;
+            auto base = Instruction::RegistersIn(w[0].operands[1]);
+            if (std::find(base.begin(), base.end(), w[0].operands[0]) != base.end())
+                return false;
+            replacement = {w[0]};
+            return true;
+        }},
+
+        // move $x, $y ; move $y, $x
+        {"copy back", 2, [](auto& w, auto&, auto& replacement)
+        {
+            if (w[0].op != "move" || w[1].op != "move" ||
+                w[0].operands[0] != w[1].operands[1] || w[0].operands[1] != w[1].operands[0])
+                return false;
+            replacement = {w[0]};
+            return true;
+        }},
+    };
+}
+
+vector<PeepholeOptimizer::Line> PeepholeOptimizer::Split(const Code& code)
+{
+    std::stringstream text;
+    text << code;
+
+    vector<Line> lines;
+    bool in_text = false;
+    string str;
+    while (std::getline(text, str))
+    {
+        Line line;
+        line.kind = Line::other;
+        line.text = str;
+
+        string content = trim(str.substr(0, str.find('#')));
+        if (content.rfind(".text", 0) == 0)
+            in_text = true;
+        else if (content.rfind(".data", 0) == 0)
+            in_text = false;
+        else if (in_text && is_label_line(content))
+        {
+            line.kind = Line::label;
+            line.name = content.substr(0, content.size() - 1);
+        }
+        else if (in_text && !content.empty() && content[0] != '.')
+        {
+            line.kind = Line::instruction;
+            line.parsed = Instruction::Parse(str);
+        }
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+Code PeepholeOptimizer::Optimize(const Code& code)
+{
+    vector<Line> lines = Split(code);
+
+    size_t max_length = 0;
+    for (auto& rule : rules)
+        max_length = std::max(max_length, rule.length);
+
+    // blank lines and comments don't break a window, directives do
+    auto transparent = [](const Line& line)
+    {
+        return line.removed || (line.kind == Line::other && trim(line.text.substr(0, line.text.find('#'))).empty());
+    };
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (size_t i = 0; i < lines.size(); i++)
+        {
+            if (lines[i].removed || lines[i].kind != Line::instruction)
+                continue;
+
+            vector<size_t> window = {i};
+            set<string> next_labels;
+            for (size_t j = i + 1; j < lines.size(); j++)
+            {
+                if (transparent(lines[j]))
+                    continue;
+                if (lines[j].kind == Line::label && window.size() == 1)
+                {
+                    next_labels.insert(lines[j].name);
+                    continue;
+                }
+                if (lines[j].kind != Line::instruction || !next_labels.empty() || window.size() == max_length)
+                    break;
+                window.push_back(j);
+            }
+
+            for (auto& rule : rules)
+            {
+                if (window.size() < rule.length)
+                    continue;
+
+                vector<Instruction> instructions;
+                for (size_t k = 0; k < rule.length; k++)
+                    instructions.push_back(lines[window[k]].parsed);
+
+                vector<Instruction> replacement;
+                if (!rule.apply(instructions, next_labels, replacement))
+                    continue;
+                assert(replacement.size() <= rule.length);
+
+                for (size_t k = 0; k < rule.length; k++)
+                {
+                    auto& line = lines[window[k]];
+                    if (k >= replacement.size())
+                        line.removed = true;
+                    else if (replacement[k].Text() != instructions[k].Text())
+                    {
+                        line.parsed = replacement[k];
+                        line.text = replacement[k].Text();
+                    }
+                }
+
+                removed[rule.name] += rule.length - replacement.size();
+                changed = true;
+                break;
+            }
+        }
+    }
+
+    Code optimized;
+    for (auto& line : lines)
+        if (!line.removed)
+            optimized += line.text + "\n";
+    return optimized;
+}
+
+string PeepholeOptimizer::Report() const
+{
+    string str;
+    for (auto& [rule, count] : removed)
+        if (count > 0)
+            str += "# peephole: " + rule + " removed " + std::to_string(count) +
+                (count == 1 ? " instruction\n" : " instructions\n");
+    return str;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "ir.hpp"
+
+
+// windowed peephole optimization over the final assembly of the program; a table of rules is
+// matched against consecutive instructions of the text section until none of them applies
+class PeepholeOptimizer
+{
+public:
+    PeepholeOptimizer();
+
+    Code Optimize(const Code& code);
+
+    // number of instructions removed by each rule
+    map<string, int> removed;
+
+    // the removal counts as assembly comments
+    string Report() const;
+
+private:
+    // a rule sees a window of instructions with no label between them and the labels directly
+    // following the first instruction; it returns whether it matched and sets the instructions
+    // replacing the window, which must not be more than the window
+    struct Rule
+    {
+        string name;
+        size_t length;
+        function<bool(const vector<Instruction>& window, const set<string>& next_labels,
+            vector<Instruction>& replacement)> apply;
+    };
+
+    vector<Rule> rules;
+
+    struct Line
+    {
+        enum { instruction, label, other } kind;
+        string text;
+        Instruction parsed;  // for instructions
+        string name;         // for labels
+        bool removed = false;
+    };
+
+    static vector<Line> Split(const Code& code);
+};
@@ -0,0 +1,297 @@
+#include "regalloc.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+
+Code RegisterAllocator::Allocate(FunctionBody& body)
+{
+    body.ComputeLiveness();
+
+    // number the instructions in layout order; each instruction reads its operands at an even
+    // position and writes its result at the following odd one, so that a register whose last
+    // use is the instruction defining another one does not overlap with it
+    vector<int> block_start(body.blocks.size()), block_end(body.blocks.size());
+    int position = 0;
+    for (size_t i = 0; i < body.blocks.size(); i++)
+    {
+        block_start[i] = position;
+        position += 2 * std::max<size_t>(1, body.blocks[i].instructions.size());
+        block_end[i] = position - 1;
+    }
+
+    // a branch to an earlier block closes a loop, uses inside loops are weighted by depth
+    vector<std::pair<int, int>> loops;
+    for (size_t i = 0; i < body.blocks.size(); i++)
+        for (auto s : body.blocks[i].successors)
+            if (s <= i)
+                loops.push_back(std::make_pair(block_start[s], block_end[i]));
+
+    auto use_weight = [&loops](int position)
+    {
+        int depth = std::count_if(loops.begin(), loops.end(),
+            [position](auto loop) { return loop.first <= position && position <= loop.second; });
+        return std::pow(10.0, std::min(depth, 6));
+    };
+
+    map<string, LiveInterval> intervals;
+    auto extend = [&intervals](const string& reg, int position)
+    {
+        auto it = intervals.find(reg);
+        if (it == intervals.end())
+        {
+            LiveInterval interval;
+            interval.reg = reg;
+            interval.start = interval.end = position;
+            intervals[reg] = interval;
+        }
+        else
+        {
+            it->second.start = std::min(it->second.start, position);
+            it->second.end = std::max(it->second.end, position);
+        }
+    };
+
+    vector<int> calls;
+    for (size_t i = 0; i < body.blocks.size(); i++)
+    {
+        auto& block = body.blocks[i];
+        for (auto& reg : block.live_in)
+            extend(reg, block_start[i]);
+
+        int position = block_start[i];
+        for (auto& instruction : block.instructions)
+        {
+            if (instruction.IsCall())
+                calls.push_back(position);
+
+            for (auto& reg : instruction.Uses())
+                if (is_virtual_register(reg))
+                {
+                    extend(reg, position);
+                    intervals[reg].weight += use_weight(position);
+                }
+            for (auto& reg : instruction.Defs())
+                if (is_virtual_register(reg))
+                {
+                    extend(reg, position + 1);
+                    intervals[reg].weight += use_weight(position);
+                }
+
+            if (instruction.op == "move" && is_virtual_register(instruction.operands[0]) &&
+                is_virtual_register(instruction.operands[1]) && intervals[instruction.operands[0]].hint.empty())
+                intervals[instruction.operands[0]].hint = instruction.operands[1];
+
+            position += 2;
+        }
+
+        for (auto& reg : block.live_out)
+            extend(reg, block_end[i]);
+    }
+
+    vector<LiveInterval*> sorted;
+    for (auto& [reg, interval] : intervals)
+    {
+        interval.crosses_call = std::any_of(calls.begin(), calls.end(),
+            [&interval](int call) { return interval.start < call && interval.end > call + 1; });
+        sorted.push_back(&interval);
+    }
+
+    ScanIntervals(sorted);
+
+    // spill slots and callee-saved registers are placed above the existing frame; intervals
+    // that don't overlap share a slot, the one whose last interval ended first
+    vector<std::pair<int, int>> slots;  // offset and end of the last interval in the slot
+    for (auto interval : sorted)
+        if (interval->assigned.empty())
+        {
+            auto slot = std::min_element(slots.begin(), slots.end(),
+                [](auto& a, auto& b) { return a.second < b.second; });
+            if (slot != slots.end() && slot->second < interval->start)
+            {
+                interval->spill_offset = slot->first;
+                slot->second = interval->end;
+                continue;
+            }
+            interval->spill_offset = frame_size;
+            slots.push_back(std::make_pair(frame_size, interval->end));
+            frame_size += FunctionContext::stack_alignment;
+        }
+
+    for (auto& reg : callee_saved_registers)
+        if (std::any_of(sorted.begin(), sorted.end(), [&reg](auto interval) { return interval->assigned == reg; }))
+        {
+            saved_registers.push_back(std::make_pair(reg, frame_size));
+            frame_size += FunctionContext::stack_alignment;
+        }
+
+    // calls overwrite the return address, leaf functions keep it in $ra
+    if (!calls.empty())
+    {
+        saved_registers.push_back(std::make_pair("$ra", frame_size));
+        frame_size += FunctionContext::stack_alignment;
+    }
+
+    Rewrite(body, intervals);
+    return body.ToCode();
+}
+
+void RegisterAllocator::ScanIntervals(vector<LiveInterval*>& intervals)
+{
+    std::sort(intervals.begin(), intervals.end(), [](auto a, auto b)
+        { return a->start < b->start || (a->start == b->start && a->end < b->end); });
+
+    map<string, LiveInterval*> by_register;
+    for (auto interval : intervals)
+        by_register[interval->reg] = interval;
+
+    set<string> free_registers;
+    free_registers.insert(caller_saved_registers.begin(), caller_saved_registers.end());
+    free_registers.insert(callee_saved_registers.begin(), callee_saved_registers.end());
+
+    vector<LiveInterval*> active;
+    for (auto current : intervals)
+    {
+        // release the registers of intervals ending before this one starts
+        for (auto it = active.begin(); it != active.end();)
+        {
+            if ((*it)->end < current->start)
+            {
+                free_registers.insert((*it)->assigned);
+                it = active.erase(it);
+            }
+            else
+                it++;
+        }
+
+        // values live across a call must survive it
+        vector<string> candidates = callee_saved_registers;
+        if (!current->crosses_call)
+            candidates.insert(candidates.begin(), caller_saved_registers.begin(), caller_saved_registers.end());
+
+        string reg;
+        if (!current->hint.empty())
+        {
+            string hinted = by_register[current->hint]->assigned;
+            if (free_registers.count(hinted) > 0 &&
+                std::find(candidates.begin(), candidates.end(), hinted) != candidates.end())
+                reg = hinted;
+        }
+        if (reg.empty())
+        {
+            auto it = std::find_if(candidates.begin(), candidates.end(),
+                [&free_registers](auto& r) { return free_registers.count(r) > 0; });
+            if (it != candidates.end())
+                reg = *it;
+        }
+
+        if (reg.empty())
+        {
+            // no register left, spill the cheapest of the competing intervals
+            LiveInterval* victim = current;
+            for (auto interval : active)
+            {
+                if (std::find(candidates.begin(), candidates.end(), interval->assigned) == candidates.end())
+                    continue;
+                if (interval->weight < victim->weight ||
+                    (interval->weight == victim->weight && interval->end > victim->end))
+                    victim = interval;
+            }
+
+            if (victim == current)
+                continue;
+
+            reg = victim->assigned;
+            victim->assigned.clear();
+            active.erase(std::find(active.begin(), active.end(), victim));
+            free_registers.insert(reg);
+        }
+
+        current->assigned = reg;
+        free_registers.erase(reg);
+        active.push_back(current);
+    }
+}
+
+void RegisterAllocator::Rewrite(FunctionBody& body, map<string, LiveInterval>& intervals)
+{
+    auto spill_slot = [](int offset) { return std::to_string(offset) + "($sp)"; };
+
+    for (auto& block : body.blocks)
+    {
+        vector<Instruction> rewritten;
+        for (auto instruction : block.instructions)
+        {
+            vector<string> spilled_uses, spilled_defs;
+            for (auto& reg : instruction.Uses())
+                if (is_virtual_register(reg))
+                {
+                    if (intervals[reg].assigned.empty())
+                    {
+                        if (std::find(spilled_uses.begin(), spilled_uses.end(), reg) == spilled_uses.end())
+                            spilled_uses.push_back(reg);
+                    }
+                    else
+                        instruction.ReplaceUses(reg, intervals[reg].assigned);
+                }
+            for (auto& reg : instruction.Defs())
+                if (is_virtual_register(reg))
+                {
+                    if (intervals[reg].assigned.empty())
+                        spilled_defs.push_back(reg);
+                    else
+                        instruction.ReplaceDefs(reg, intervals[reg].assigned);
+                }
+
+            // copies between registers that ended up in the same place
+            if (instruction.op == "move" && instruction.operands[0] == instruction.operands[1])
+                continue;
+
+            // copies from or to a spilled register become a plain load or store
+            if (instruction.op == "move" && spilled_uses.size() + spilled_defs.size() == 1)
+            {
+                if (!spilled_defs.empty())
+                    rewritten.push_back(Instruction("sw",
+                        {instruction.operands[1], spill_slot(intervals[spilled_defs[0]].spill_offset)}));
+                else
+                    rewritten.push_back(Instruction("lw",
+                        {instruction.operands[0], spill_slot(intervals[spilled_uses[0]].spill_offset)}));
+                continue;
+            }
+
+            vector<string> scratch;
+            for (auto& reg : scratch_registers)
+            {
+                bool used = false;
+                for (auto& operand : instruction.operands)
+                    for (auto& r : Instruction::RegistersIn(operand))
+                        used = used || r == reg;
+                if (!used)
+                    scratch.push_back(reg);
+            }
+            assert(scratch.size() >= spilled_uses.size());
+
+            map<string, string> scratch_of;
+            for (size_t i = 0; i < spilled_uses.size(); i++)
+            {
+                auto& reg = spilled_uses[i];
+                scratch_of[reg] = scratch[i];
+                rewritten.push_back(Instruction("lw", {scratch[i], spill_slot(intervals[reg].spill_offset)}));
+                instruction.ReplaceUses(reg, scratch[i]);
+            }
+
+            vector<Instruction> stores;
+            for (auto& reg : spilled_defs)
+            {
+                assert(!scratch.empty());
+                string s = scratch_of.count(reg) > 0 ? scratch_of[reg] : scratch[0];
+                instruction.ReplaceDefs(reg, s);
+                stores.push_back(Instruction("sw", {s, spill_slot(intervals[reg].spill_offset)}));
+            }
+
+            rewritten.push_back(instruction);
+            rewritten.insert(rewritten.end(), stores.begin(), stores.end());
+        }
+        block.instructions = rewritten;
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "ir.hpp"
+
+
+// linear scan register allocation over live intervals of virtual registers;
+// intervals live across a call are given callee-saved registers, and when no register
+// is left the interval with the lowest loop-weighted use count is spilled to the stack, in a
+// slot it shares with spilled intervals it doesn't overlap
+class RegisterAllocator
+{
+public:
+    // frame_size is the size of the stack frame before any spill slot is added
+    RegisterAllocator(int frame_size) : frame_size(frame_size) {}
+
+    // replaces the virtual registers of body by machine registers and spill slots
+    Code Allocate(FunctionBody& body);
+
+    // size of the stack frame including spill slots and saved registers
+    int frame_size;
+
+    // callee-saved registers used by the allocation, and $ra if the body makes calls,
+    // with the stack offsets to save them at
+    vector<std::pair<string, int>> saved_registers;
+
+    static inline const vector<string> caller_saved_registers =
+        {"$t0", "$t1", "$t2", "$t3", "$t4", "$t5", "$t6", "$t7", "$t8", "$t9"};
+    static inline const vector<string> callee_saved_registers =
+        {"$s0", "$s1", "$s2", "$s3", "$s4", "$s5", "$s6", "$s7"};
+
+    // used to reload and store spilled registers around an instruction; the code generator
+    // only keeps values in $v0 and $v1 between instructions that don't involve virtual registers
+    static inline const vector<string> scratch_registers = {"$v1", "$v0"};
+
+private:
+    struct LiveInterval
+    {
+        string reg;
+        int start, end;
+        double weight = 0;
+        bool crosses_call = false;
+        string hint;  // register this one is copied from, preferred to remove the copy
+
+        string assigned;
+        int spill_offset = -1;
+    };
+
+    void ScanIntervals(vector<LiveInterval*>& intervals);
+
+    void Rewrite(FunctionBody& body, map<string, LiveInterval>& intervals);
+};
@@ -0,0 +1,219 @@
+#include "runtime.hpp"
+
+
+const vector<RuntimeRoutine>& Runtime()
+{
+    static const vector<RuntimeRoutine> routines = {
+        {"print_string", R"(print_string:
+    # $a0 : string address
+    li $v0, 4
+    syscall
+    jr $ra
+)"},
+        {"print_char", R"(print_char:
+    # $a0 : character value
+    li $v0, 11
+    syscall
+    jr $ra
+)"},
+        {"print_int", R"(print_int:
+    # $a0 : integer value
+    li $v0, 1
+    syscall
+    jr $ra
+)"},
+        {"read_string", R"(read_string:
+    # $a0 : input buffer address
+    # $a1 : maximum number of characters to read
+    li $v0, 8
+    syscall
+    jr $ra
+)"},
+        {"read_char", R"(read_char:
+    li $v0, 12
+    syscall
+    # $v0 contains character read
+    jr $ra
+)"},
+        {"read_int", R"(read_int:
+    li $v0, 5
+    syscall
+    # $v0 contains integer read
+    jr $ra
+)"},
+        {"exit", R"(exit: # terminate without value
+    li $v0, 10
+    syscall
+)"},
+        {"exit2", R"(exit2: # terminate with value
+    # $a0 : termination result
+    li $v0, 17
+    syscall
+)"},
+        // the string routines go a word at a time where the addresses allow it; a word has a null
+        // character when (x - 0x01010101) & ~x & 0x80808080 isn't 0
+        {"$string_length", R"($string_length:
+    # $a0 : string address
+    # $v0 : number of characters before the null
+    move $v0, $a0
+$string_length_align:
+    andi $t0, $v0, 3
+    beqz $t0, $string_length_words
+    lbu $t1, ($v0)
+    beqz $t1, $string_length_end
+    addu $v0, $v0, 1
+    b $string_length_align
+$string_length_words:
+    li $t2, 0x01010101
+    li $t3, 0x80808080
+$string_length_word:
+    lw $t1, ($v0)
+    subu $t0, $t1, $t2
+    nor $t4, $t1, $zero
+    and $t0, $t0, $t4
+    and $t0, $t0, $t3
+    bnez $t0, $string_length_bytes
+    addu $v0, $v0, 4
+    b $string_length_word
+$string_length_bytes:
+    lbu $t1, ($v0)
+    beqz $t1, $string_length_end
+    addu $v0, $v0, 1
+    b $string_length_bytes
+$string_length_end:
+    subu $v0, $v0, $a0
+    jr $ra
+)"},
+        {"$string_copy", R"($string_copy:
+    # $a0 : destination address
+    # $a1 : source address
+    # $v0 : number of characters copied before the null, which is copied too
+    # words are copied when both addresses can be aligned, they are then 0 or at least 4
+    # apart and every word is read before the copy writes over it
+    move $t5, $a1
+    xor $t0, $a0, $a1
+    andi $t0, $t0, 3
+    bnez $t0, $string_copy_bytes
+$string_copy_align:
+    andi $t0, $a1, 3
+    beqz $t0, $string_copy_words
+    lbu $t1, ($a1)
+    sb $t1, ($a0)
+    beqz $t1, $string_copy_end
+    addu $a0, $a0, 1
+    addu $a1, $a1, 1
+    b $string_copy_align
+$string_copy_words:
+    li $t2, 0x01010101
+    li $t3, 0x80808080
+$string_copy_word:
+    lw $t1, ($a1)
+    subu $t0, $t1, $t2
+    nor $t4, $t1, $zero
+    and $t0, $t0, $t4
+    and $t0, $t0, $t3
+    bnez $t0, $string_copy_bytes
+    sw $t1, ($a0)
+    addu $a0, $a0, 4
+    addu $a1, $a1, 4
+    b $string_copy_word
+$string_copy_bytes:
+    lbu $t1, ($a1)
+    sb $t1, ($a0)
+    addu $a0, $a0, 1
+    addu $a1, $a1, 1
+    bnez $t1, $string_copy_bytes
+    subu $a1, $a1, 1
+$string_copy_end:
+    subu $v0, $a1, $t5
+    jr $ra
+)"},
+        {"$string_prefix", R"($string_prefix:
+    # $a0 : first string address
+    # $a1 : second string address
+    # $v0 : number of characters the strings share before a difference or their null
+    move $t5, $a0
+    xor $t0, $a0, $a1
+    andi $t0, $t0, 3
+    bnez $t0, $string_prefix_bytes
+$string_prefix_align:
+    andi $t0, $a0, 3
+    beqz $t0, $string_prefix_words
+    lbu $t1, ($a0)
+    lbu $t6, ($a1)
+    bne $t1, $t6, $string_prefix_end
+    beqz $t1, $string_prefix_end
+    addu $a0, $a0, 1
+    addu $a1, $a1, 1
+    b $string_prefix_align
+$string_prefix_words:
+    li $t2, 0x01010101
+    li $t3, 0x80808080
+$string_prefix_word:
+    lw $t1, ($a0)
+    lw $t6, ($a1)
+    bne $t1, $t6, $string_prefix_bytes
+    subu $t0, $t1, $t2
+    nor $t4, $t1, $zero
+    and $t0, $t0, $t4
+    and $t0, $t0, $t3
+    bnez $t0, $string_prefix_bytes
+    addu $a0, $a0, 4
+    addu $a1, $a1, 4
+    b $string_prefix_word
+$string_prefix_bytes:
+    lbu $t1, ($a0)
+    lbu $t6, ($a1)
+    bne $t1, $t6, $string_prefix_end
+    beqz $t1, $string_prefix_end
+    addu $a0, $a0, 1
+    addu $a1, $a1, 1
+    b $string_prefix_bytes
+$string_prefix_end:
+    subu $v0, $a0, $t5
+    jr $ra
+)"},
+        {"$fill_bytes", R"($fill_bytes:
+    # $a0 : array address
+    # $a1 : character value
+    # $a2 : number of characters, at least 1
+    andi $a1, $a1, 0xff
+    addu $t5, $a0, $a2
+$fill_bytes_align:
+    andi $t0, $a0, 3
+    beqz $t0, $fill_bytes_words
+    sb $a1, ($a0)
+    addu $a0, $a0, 1
+    bne $a0, $t5, $fill_bytes_align
+    jr $ra
+$fill_bytes_words:
+    sll $t1, $a1, 8
+    or $t1, $t1, $a1
+    sll $t0, $t1, 16
+    or $t1, $t1, $t0
+    li $t0, -4
+    and $t4, $t5, $t0
+$fill_bytes_word:
+    bgeu $a0, $t4, $fill_bytes_bytes
+    sw $t1, ($a0)
+    addu $a0, $a0, 4
+    b $fill_bytes_word
+$fill_bytes_bytes:
+    beq $a0, $t5, $fill_bytes_end
+    sb $a1, ($a0)
+    addu $a0, $a0, 1
+    b $fill_bytes_bytes
+$fill_bytes_end:
+    jr $ra
+)"},
+        {"$out_of_bounds_error", R"($out_of_bounds_error:
+    la $a0, $out_of_bounds_error_msg
+    jal print_string
+    li $a0, 1
+    j exit2
+)", R"($out_of_bounds_error_msg:
+    .asciiz "index out of bounds error!\n"
+)"}
+    };
+    return routines;
+}
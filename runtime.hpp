@@ -0,0 +1,16 @@
+#pragma once
+
+#include "translation.hpp"
+
+
+// a routine of the runtime the compiled programs are linked with; the runtime is built into the
+// compiler, and a program only gets the routines it reaches
+struct RuntimeRoutine
+{
+    string name;
+    string text;
+    string data;  // the data only the routine uses, such as the text of a message
+};
+
+// the routines of the runtime, mostly syscall wrappers, in the order they are emitted in
+const vector<RuntimeRoutine>& Runtime();
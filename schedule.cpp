@@ -0,0 +1,197 @@
+#include "optimizer.hpp"
+
+#include <algorithm>
+
+
+const PipelineModel* PipelineModel::Find(const string& name)
+{
+    // cycles from issuing an instruction to the first one able to use its result, roughly those of
+    // the classic five stage pipeline with a load delay of one and of the eight stage R4000
+    static const map<string, PipelineModel> models = {
+        {"r3000", {{{"lw", 2}, {"lh", 2}, {"lhu", 2}, {"lb", 2}, {"lbu", 2}, {"mult", 12}, {"multu", 12},
+            {"mul", 12}, {"div", 35}, {"divu", 35}, {"rem", 35}, {"remu", 35}}}},
+        {"r4000", {{{"lw", 3}, {"lh", 3}, {"lhu", 3}, {"lb", 3}, {"lbu", 3}, {"mult", 10}, {"multu", 10},
+            {"mul", 10}, {"div", 69}, {"divu", 69}, {"rem", 69}, {"remu", 69}}}},
+    };
+    auto it = models.find(name);
+    return it == models.end() ? nullptr : &it->second;
+}
+
+int PipelineModel::Latency(const Instruction& instruction) const
+{
+    auto it = latencies.find(instruction.op);
+    return it == latencies.end() ? 1 : it->second;
+}
+
+
+// bytes a load or store accesses
+static int AccessWidth(const Instruction& instruction)
+{
+    switch (instruction.op[1])
+    {
+    case 'b':
+        return 1;
+    case 'h':
+        return 2;
+    default:
+        return 4;
+    }
+}
+
+// the constant offset of an address relative to a register
+static int Offset(const string& address)
+{
+    string offset = address.substr(0, address.find('('));
+    return offset.empty() ? 0 : std::stoi(offset, nullptr, 0);
+}
+
+// whether two memory accesses may touch the same bytes; slots of the stack frame at different
+// offsets don't, as $sp doesn't change inside the body
+static bool Overlap(const Instruction& a, const Instruction& b, const set<string>& arrays)
+{
+    auto& address_a = a.operands[1];
+    auto& address_b = b.operands[1];
+    auto location_a = MemoryLocation::Of(address_a), location_b = MemoryLocation::Of(address_b);
+    if (location_a.kind == MemoryLocation::Stack && location_b.kind == MemoryLocation::Stack)
+    {
+        int offset_a = Offset(address_a), offset_b = Offset(address_b);
+        return offset_a < offset_b + AccessWidth(b) && offset_b < offset_a + AccessWidth(a);
+    }
+    return location_a.MayAlias(location_b, arrays);
+}
+
+
+// a list scheduler over the instructions of a stretch of blocks: an instruction is issued once
+// the instructions it depends on are, in the first cycle its operands are ready, preferring the
+// one with the longest latency path behind it; when none is ready the pipeline stalls
+class ListScheduler
+{
+public:
+    ListScheduler(const PipelineModel& model, const set<string>& arrays) : model(model), arrays(arrays) {}
+
+    vector<Instruction> Schedule(const vector<Instruction>& instructions);
+
+private:
+    const PipelineModel& model;
+    const set<string>& arrays;
+
+    // calls, system calls, branches and comments keep their place among the other instructions
+    static bool Barrier(const Instruction& instruction)
+    {
+        return instruction.IsComment() || instruction.IsTerminator() || instruction.IsCall() ||
+            instruction.op == "syscall" || instruction.op == "nop" || instruction.op == "break";
+    }
+};
+
+vector<Instruction> ListScheduler::Schedule(const vector<Instruction>& instructions)
+{
+    size_t n = instructions.size();
+
+    // edges to later instructions with the cycles between them: the latency of the earlier one
+    // for a value it writes, one cycle to keep a write after the reads and writes before it
+    vector<vector<std::pair<size_t, int>>> successors(n);
+    vector<int> waiting(n, 0);
+    for (size_t j = 0; j < n; j++)
+        for (size_t i = 0; i < j; i++)
+        {
+            auto& a = instructions[i];
+            auto& b = instructions[j];
+            int delay = -1;
+
+            if (Barrier(a) || Barrier(b))
+                delay = 1;
+            if ((a.IsStore() && (b.IsLoad() || b.IsStore())) || (a.IsLoad() && b.IsStore()))
+                if (Overlap(a, b, arrays))
+                    delay = 1;
+
+            auto a_defs = a.Defs(), a_uses = a.Uses(), b_defs = b.Defs(), b_uses = b.Uses();
+            for (auto& reg : a_defs)
+            {
+                if (std::find(b_uses.begin(), b_uses.end(), reg) != b_uses.end())
+                    delay = std::max(delay, model.Latency(a));
+                if (std::find(b_defs.begin(), b_defs.end(), reg) != b_defs.end())
+                    delay = std::max(delay, 1);
+            }
+            for (auto& reg : a_uses)
+                if (std::find(b_defs.begin(), b_defs.end(), reg) != b_defs.end())
+                    delay = std::max(delay, 1);
+
+            if (delay >= 0)
+            {
+                successors[i].push_back(std::make_pair(j, delay));
+                waiting[j]++;
+            }
+        }
+
+    // the longest path of cycles from each instruction to the end
+    vector<int> height(n, 0);
+    for (size_t i = n; i-- > 0;)
+    {
+        height[i] = model.Latency(instructions[i]);
+        for (auto [j, delay] : successors[i])
+            height[i] = std::max(height[i], delay + height[j]);
+    }
+
+    vector<int> ready_cycle(n, 0);
+    vector<size_t> ready;
+    for (size_t i = 0; i < n; i++)
+        if (waiting[i] == 0)
+            ready.push_back(i);
+
+    vector<Instruction> scheduled;
+    int cycle = 0;
+    while (!ready.empty())
+    {
+        // the instruction able to issue first, the most urgent one among those, then the earliest
+        auto best = std::min_element(ready.begin(), ready.end(), [&](size_t a, size_t b)
+        {
+            int issue_a = std::max(cycle, ready_cycle[a]), issue_b = std::max(cycle, ready_cycle[b]);
+            if (issue_a != issue_b)
+                return issue_a < issue_b;
+            if (height[a] != height[b])
+                return height[a] > height[b];
+            return a < b;
+        });
+        size_t i = *best;
+        ready.erase(best);
+
+        cycle = std::max(cycle, ready_cycle[i]);
+        scheduled.push_back(instructions[i]);
+        for (auto [j, delay] : successors[i])
+        {
+            ready_cycle[j] = std::max(ready_cycle[j], cycle + delay);
+            if (--waiting[j] == 0)
+                ready.push_back(j);
+        }
+        cycle++;
+    }
+    return scheduled;
+}
+
+
+void ScheduleInstructions(FunctionBody& body, const PipelineModel& model)
+{
+    auto arrays = body.GlobalArrays();
+    ListScheduler scheduler(model, arrays);
+
+    // a block only entered by falling through from the one before it continues the stretch of
+    // that block, its instructions may move up into it; all of them end up in the last block,
+    // which the empty ones before it fall through to
+    for (size_t first = 0; first < body.blocks.size();)
+    {
+        size_t last = first;
+        while (last + 1 < body.blocks.size() && body.blocks[last + 1].predecessors == vector<size_t>{last} &&
+            (body.blocks[last].instructions.empty() || !body.blocks[last].instructions.back().IsTerminator()))
+            last++;
+
+        vector<Instruction> instructions;
+        for (size_t b = first; b <= last; b++)
+        {
+            auto& block = body.blocks[b].instructions;
+            instructions.insert(instructions.end(), block.begin(), block.end());
+            block.clear();
+        }
+        body.blocks[last].instructions = scheduler.Schedule(instructions);
+        first = last + 1;
+    }
+}
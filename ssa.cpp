@@ -0,0 +1,294 @@
+#include "ir.hpp"
+
+#include <algorithm>
+
+
+void FunctionBody::ConstructSSA()
+{
+    RemoveUnreachableBlocks();
+
+    // the entry block must not be a branch target so that it can't need phi instructions
+    if (!blocks[0].predecessors.empty())
+    {
+        blocks.insert(blocks.begin(), BasicBlock());
+        BuildControlFlowGraph();
+    }
+
+    ComputeLiveness();
+    vector<size_t> idom = ComputeDominators();
+
+    vector<vector<size_t>> children(blocks.size());
+    for (size_t b = 1; b < blocks.size(); b++)
+        children[idom[b]].push_back(b);
+
+    vector<set<size_t>> frontier(blocks.size());
+    for (size_t b = 0; b < blocks.size(); b++)
+        if (blocks[b].predecessors.size() > 1)
+            for (auto p : blocks[b].predecessors)
+                for (size_t runner = p; runner != idom[b]; runner = idom[runner])
+                    frontier[runner].insert(b);
+
+    map<string, set<size_t>> definitions;
+    for (size_t b = 0; b < blocks.size(); b++)
+        for (auto& instruction : blocks[b].instructions)
+            for (auto& reg : instruction.Defs())
+                if (is_virtual_register(reg))
+                    definitions[reg].insert(b);
+
+    // place phi instructions on the iterated dominance frontier of the definitions,
+    // only where the register is live
+    vector<vector<string>> phi_registers(blocks.size());
+    for (auto& [reg, blocks_defining] : definitions)
+    {
+        vector<size_t> worklist(blocks_defining.begin(), blocks_defining.end());
+        set<size_t> has_phi;
+        while (!worklist.empty())
+        {
+            size_t b = worklist.back();
+            worklist.pop_back();
+            for (auto f : frontier[b])
+            {
+                if (has_phi.count(f) > 0 || blocks[f].live_in.count(reg) == 0)
+                    continue;
+                has_phi.insert(f);
+
+                vector<string> operands(blocks[f].predecessors.size() + 1, reg);
+                blocks[f].instructions.insert(blocks[f].instructions.begin(), Instruction("phi", operands));
+                phi_registers[f].insert(phi_registers[f].begin(), reg);
+
+                if (blocks_defining.count(f) == 0)
+                    worklist.push_back(f);
+            }
+        }
+    }
+
+    // rename along the dominator tree, a register without reaching definition keeps its name
+    map<string, vector<string>> current;
+    function<void(size_t)> rename = [&](size_t b)
+    {
+        vector<string> pushed;
+        for (auto& instruction : blocks[b].instructions)
+        {
+            if (!instruction.IsPhi())
+                for (auto& reg : instruction.Uses())
+                    if (is_virtual_register(reg) && !current[reg].empty())
+                        instruction.ReplaceUses(reg, current[reg].back());
+
+            for (auto& reg : instruction.Defs())
+                if (is_virtual_register(reg))
+                {
+                    string renamed = NewRegister();
+                    instruction.ReplaceDefs(reg, renamed);
+                    current[reg].push_back(renamed);
+                    pushed.push_back(reg);
+                }
+        }
+
+        for (auto s : blocks[b].successors)
+        {
+            size_t index = std::find(blocks[s].predecessors.begin(), blocks[s].predecessors.end(), b) -
+                blocks[s].predecessors.begin();
+            for (size_t k = 0; k < phi_registers[s].size(); k++)
+            {
+                auto& reg = phi_registers[s][k];
+                if (!current[reg].empty())
+                    blocks[s].instructions[k].operands[index + 1] = current[reg].back();
+            }
+        }
+
+        for (auto c : children[b])
+            rename(c);
+
+        for (auto& reg : pushed)
+            current[reg].pop_back();
+    };
+    rename(0);
+}
+
+void FunctionBody::DestructSSA()
+{
+    ComputeLiveness();
+
+    // interference between registers live at the same time and holding different values
+    map<string, set<string>> interference;
+    auto interfere = [&interference](const string& a, const string& b)
+    {
+        interference[a].insert(b);
+        interference[b].insert(a);
+    };
+
+    for (auto& block : blocks)
+    {
+        set<string> live = block.live_out;
+        size_t phi_count = block.PhiCount();
+        for (size_t i = block.instructions.size(); i-- > phi_count;)
+        {
+            auto& instruction = block.instructions[i];
+            auto defs = instruction.Defs(), uses = instruction.Uses();
+            for (auto& d : defs)
+                if (is_virtual_register(d))
+                    for (auto& l : live)
+                        if (l != d && !(instruction.op == "move" && l == instruction.operands[1]))
+                            interfere(d, l);
+            for (auto& d : defs)
+                live.erase(d);
+            for (auto& u : uses)
+                if (is_virtual_register(u))
+                    live.insert(u);
+        }
+
+        for (size_t k = 0; k < phi_count; k++)
+            live.insert(block.instructions[k].operands[0]);
+        for (size_t k = 0; k < phi_count; k++)
+            for (auto& l : live)
+                if (l != block.instructions[k].operands[0])
+                    interfere(block.instructions[k].operands[0], l);
+    }
+
+    // merge the operands of each phi with its destination unless two of the merged registers interfere
+    map<string, string> parent;
+    map<string, vector<string>> members;
+    function<string(const string&)> find = [&](const string& reg) -> string
+    {
+        auto it = parent.find(reg);
+        if (it == parent.end() || it->second == reg)
+            return reg;
+        return it->second = find(it->second);
+    };
+
+    auto mergeable = [&](const string& a, const string& b)
+    {
+        auto as = members.count(a) > 0 ? members[a] : vector<string>{a};
+        auto bs = members.count(b) > 0 ? members[b] : vector<string>{b};
+        for (auto& x : as)
+            for (auto& y : bs)
+                if (interference[x].count(y) > 0)
+                    return false;
+        return true;
+    };
+
+    for (auto& block : blocks)
+        for (size_t k = 0; k < block.PhiCount(); k++)
+        {
+            auto& phi = block.instructions[k];
+            for (size_t j = 1; j < phi.operands.size(); j++)
+            {
+                if (!is_virtual_register(phi.operands[j]))
+                    continue;
+                string a = find(phi.operands[0]), b = find(phi.operands[j]);
+                if (a == b || !mergeable(a, b))
+                    continue;
+
+                if (members.count(a) == 0)
+                    members[a] = {a};
+                if (members.count(b) == 0)
+                    members[b] = {b};
+                members[a].insert(members[a].end(), members[b].begin(), members[b].end());
+                members.erase(b);
+                parent[a] = a;
+                parent[b] = a;
+            }
+        }
+
+    // a copy into the destination of a phi can be put directly at the end of a predecessor
+    // when no other register merged with the destination is still needed there
+    auto copy_allowed = [&](size_t p, const string& dest)
+    {
+        auto& instructions = blocks[p].instructions;
+        if (!instructions.empty() && instructions.back().IsTerminator())
+            for (auto& reg : instructions.back().Uses())
+                if (is_virtual_register(reg) && find(reg) == dest)
+                    return false;
+        for (auto& reg : blocks[p].live_out)
+            if (find(reg) == dest)
+                return false;
+        return true;
+    };
+
+    vector<vector<Instruction>> copies_at_end(blocks.size()), copies_at_start(blocks.size());
+    for (size_t b = 0; b < blocks.size(); b++)
+    {
+        auto& block = blocks[b];
+        for (size_t k = 0; k < block.PhiCount(); k++)
+        {
+            auto& phi = block.instructions[k];
+            string dest = find(phi.operands[0]);
+
+            bool direct = true;
+            for (size_t j = 1; j < phi.operands.size(); j++)
+                if (find(phi.operands[j]) != dest && !copy_allowed(block.predecessors[j - 1], dest))
+                    direct = false;
+
+            // otherwise the value goes through a new register, copied to the destination on entry
+            string source = dest;
+            if (!direct)
+            {
+                source = NewRegister();
+                copies_at_start[b].push_back(Instruction("move", {dest, source}));
+            }
+
+            for (size_t j = 1; j < phi.operands.size(); j++)
+            {
+                string value = is_virtual_register(phi.operands[j]) ? find(phi.operands[j]) : phi.operands[j];
+                if (value != source)
+                    copies_at_end[block.predecessors[j - 1]].push_back(Instruction("move", {source, value}));
+            }
+        }
+    }
+
+    for (size_t b = 0; b < blocks.size(); b++)
+    {
+        auto& instructions = blocks[b].instructions;
+        instructions.erase(instructions.begin(), instructions.begin() + blocks[b].PhiCount());
+
+        for (auto& instruction : instructions)
+            for (auto& reg : instruction.Uses())
+                if (is_virtual_register(reg) && find(reg) != reg)
+                    instruction.RenameRegister(reg, find(reg));
+        for (auto& instruction : instructions)
+            for (auto& reg : instruction.Defs())
+                if (is_virtual_register(reg) && find(reg) != reg)
+                    instruction.RenameRegister(reg, find(reg));
+
+        instructions.insert(instructions.begin(), copies_at_start[b].begin(), copies_at_start[b].end());
+    }
+
+    for (size_t b = 0; b < blocks.size(); b++)
+    {
+        auto& instructions = blocks[b].instructions;
+        auto position = !instructions.empty() && instructions.back().IsTerminator() ?
+            instructions.end() - 1 : instructions.end();
+        auto copies = SequenceCopies(copies_at_end[b]);
+        instructions.insert(position, copies.begin(), copies.end());
+    }
+}
+
+vector<Instruction> FunctionBody::SequenceCopies(vector<Instruction> copies)
+{
+    // the copies of the phis at the end of a predecessor happen at once, a register is only
+    // overwritten once no other copy reads it, and a cycle of copies is broken with a new register
+    vector<Instruction> sequence;
+    while (!copies.empty())
+    {
+        auto free = std::find_if(copies.begin(), copies.end(), [&copies](const Instruction& copy)
+        {
+            return std::none_of(copies.begin(), copies.end(),
+                [&copy](const Instruction& other) { return &other != &copy && other.operands[1] == copy.operands[0]; });
+        });
+
+        if (free == copies.end())
+        {
+            string saved = copies[0].operands[0], temp = NewRegister();
+            sequence.push_back(Instruction("move", {temp, saved}));
+            for (auto& copy : copies)
+                if (copy.operands[1] == saved)
+                    copy.operands[1] = temp;
+            continue;
+        }
+
+        if (free->operands[0] != free->operands[1])
+            sequence.push_back(*free);
+        copies.erase(free);
+    }
+    return sequence;
+}
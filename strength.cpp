@@ -0,0 +1,275 @@
+#include "optimizer.hpp"
+
+#include <cstdint>
+
+
+// rough cost of each instruction in cycles; the multiplier takes several cycles to produce
+// its result and a division many more, while the other instructions take one
+static const map<string, int> instruction_cost = {
+    {"div", 35}, {"rem", 35}, {"mul", 5}, {"mult", 5}, {"mfhi", 1}, {"li", 1},
+    {"sll", 1}, {"sra", 1}, {"srl", 1}, {"addu", 1}, {"subu", 1}, {"negu", 1}, {"move", 1}};
+
+static int sequence_cost(const vector<Instruction>& sequence)
+{
+    int cost = 0;
+    for (auto& instruction : sequence)
+        cost += instruction_cost.at(instruction.op);
+    return cost;
+}
+
+// signed digits of value in canonical form, as (shift, sign) pairs from the lowest digit;
+// no two consecutive digits are nonzero, which minimizes the number of additions
+static vector<std::pair<int, int>> signed_digits(uint32_t value)
+{
+    vector<std::pair<int, int>> digits;
+    uint64_t rest = value;
+    for (int shift = 0; rest != 0; shift++, rest >>= 1)
+    {
+        if ((rest & 1) == 0)
+            continue;
+        if ((rest & 3) == 3)
+        {
+            digits.push_back(std::make_pair(shift, -1));
+            rest += 1;
+        }
+        else
+        {
+            digits.push_back(std::make_pair(shift, 1));
+            rest -= 1;
+        }
+    }
+    return digits;
+}
+
+// instructions computing dest = source * value with shifts, additions and subtractions
+static vector<Instruction> multiply_sequence(FunctionBody& body, const string& dest, const string& source, int value)
+{
+    if (value == 0)
+        return {Instruction("move", {dest, "$zero"})};
+
+    bool negative = value < 0;
+    auto digits = signed_digits(negative ? -uint32_t(value) : uint32_t(value));
+
+    // the highest digit is always positive, start from it
+    vector<Instruction> sequence;
+    auto shifted = [&](int shift)
+    {
+        if (shift == 0)
+            return source;
+        string reg = body.NewRegister();
+        sequence.push_back(Instruction("sll", {reg, source, std::to_string(shift)}));
+        return reg;
+    };
+
+    string result = shifted(digits.back().first);
+    for (size_t i = digits.size() - 1; i-- > 0;)
+    {
+        string term = shifted(digits[i].first);
+        string sum = body.NewRegister();
+        sequence.push_back(Instruction(digits[i].second > 0 ? "addu" : "subu", {sum, result, term}));
+        result = sum;
+    }
+
+    if (negative)
+        sequence.push_back(Instruction("negu", {dest, result}));
+    else if (sequence.empty())
+        sequence.push_back(Instruction("move", {dest, result}));
+    else
+        sequence.back().ReplaceDefs(sequence.back().operands[0], dest);
+    return sequence;
+}
+
+// multiplier and shift such that the high word of n * multiplier, corrected by n when the signs
+// differ and shifted right, is n / divisor rounded towards zero; from Hacker's Delight, 10-4
+static void division_magic(int divisor, int32_t& multiplier, int& shift)
+{
+    const uint32_t two31 = 0x80000000;
+    uint32_t ad = divisor < 0 ? -uint32_t(divisor) : uint32_t(divisor);
+    uint32_t t = two31 + (uint32_t(divisor) >> 31);
+    uint32_t anc = t - 1 - t % ad;
+    uint32_t q1 = two31 / anc, r1 = two31 - q1 * anc;
+    uint32_t q2 = two31 / ad, r2 = two31 - q2 * ad;
+    uint32_t delta;
+    int p = 31;
+    do
+    {
+        p++;
+        q1 = 2 * q1;
+        r1 = 2 * r1;
+        if (r1 >= anc)
+        {
+            q1++;
+            r1 -= anc;
+        }
+        q2 = 2 * q2;
+        r2 = 2 * r2;
+        if (r2 >= ad)
+        {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    multiplier = int32_t(q2 + 1);
+    if (divisor < 0)
+        multiplier = -multiplier;
+    shift = p - 32;
+}
+
+// instructions computing dest = source / value or source % value, rounding towards zero
+static vector<Instruction> divide_sequence(FunctionBody& body, const string& dest, const string& source,
+    int value, bool remainder)
+{
+    if (value == 1 || value == -1)
+    {
+        if (remainder)
+            return {Instruction("move", {dest, "$zero"})};
+        if (value == 1)
+            return {Instruction("move", {dest, source})};
+        return {Instruction("negu", {dest, source})};
+    }
+
+    vector<Instruction> sequence;
+    auto emit = [&](const string& op, vector<string> operands)
+    {
+        string reg = body.NewRegister();
+        operands.insert(operands.begin(), reg);
+        sequence.push_back(Instruction(op, operands));
+        return reg;
+    };
+
+    uint32_t magnitude = value < 0 ? -uint32_t(value) : uint32_t(value);
+    string quotient;
+    if ((magnitude & (magnitude - 1)) == 0)
+    {
+        // add divisor - 1 to negative dividends so that the shift rounds towards zero
+        int k = 0;
+        while ((uint32_t(1) << k) != magnitude)
+            k++;
+        string sign = k == 1 ? source : emit("sra", {source, "31"});
+        string bias = emit("srl", {sign, std::to_string(32 - k)});
+        string biased = emit("addu", {source, bias});
+
+        if (remainder)
+        {
+            // the remainder takes the sign of the dividend whatever the sign of the divisor
+            string rounded = emit("sra", {biased, std::to_string(k)});
+            string multiple = emit("sll", {rounded, std::to_string(k)});
+            sequence.push_back(Instruction("subu", {dest, source, multiple}));
+            return sequence;
+        }
+
+        quotient = emit("sra", {biased, std::to_string(k)});
+        if (value < 0)
+            quotient = emit("negu", {quotient});
+    }
+    else
+    {
+        int32_t multiplier;
+        int shift;
+        division_magic(value, multiplier, shift);
+
+        string m = emit("li", {std::to_string(multiplier)});
+        sequence.push_back(Instruction("mult", {source, m}));
+        quotient = emit("mfhi", {});
+        if (value > 0 && multiplier < 0)
+            quotient = emit("addu", {quotient, source});
+        else if (value < 0 && multiplier > 0)
+            quotient = emit("subu", {quotient, source});
+        if (shift > 0)
+            quotient = emit("sra", {quotient, std::to_string(shift)});
+
+        // negative quotients are one too low, add their sign bit
+        string sign = emit("srl", {quotient, "31"});
+        quotient = emit("addu", {quotient, sign});
+    }
+
+    if (remainder)
+    {
+        string product = emit("mul", {quotient, std::to_string(value)});
+        sequence.push_back(Instruction("subu", {dest, source, product}));
+    }
+    else
+        sequence.back().ReplaceDefs(quotient, dest);
+    return sequence;
+}
+
+void ReduceStrength(FunctionBody& body)
+{
+    // values of registers defined by li, each register has a single definition in SSA form
+    map<string, int> constants;
+    for (auto& block : body.blocks)
+        for (auto& instruction : block.instructions)
+            if (instruction.op == "li" && is_virtual_register(instruction.operands[0]))
+                constants[instruction.operands[0]] = std::stoi(instruction.operands[1], nullptr, 0);
+
+    auto constant_operand = [&constants](const string& operand, int& value)
+    {
+        if (operand == "$zero")
+            value = 0;
+        else if (constants.count(operand) > 0)
+            value = constants[operand];
+        else if (!is_register(operand))
+            value = std::stoi(operand, nullptr, 0);
+        else
+            return false;
+        return true;
+    };
+
+    // divisions go first since the remainder multiplies the quotient back
+    for (auto& block : body.blocks)
+    {
+        vector<Instruction> reduced;
+        for (auto& instruction : block.instructions)
+        {
+            auto& ops = instruction.operands;
+            int value;
+            if ((instruction.op == "div" || instruction.op == "rem") && ops.size() == 3 &&
+                is_register(ops[1]) && constant_operand(ops[2], value) && value != 0)
+            {
+                auto sequence = divide_sequence(body, ops[0], ops[1], value, instruction.op == "rem");
+                if (sequence_cost(sequence) < instruction_cost.at(instruction.op))
+                {
+                    reduced.insert(reduced.end(), sequence.begin(), sequence.end());
+                    continue;
+                }
+            }
+            reduced.push_back(instruction);
+        }
+        block.instructions = reduced;
+    }
+
+    for (auto& block : body.blocks)
+    {
+        vector<Instruction> reduced;
+        for (auto& instruction : block.instructions)
+        {
+            if (instruction.op != "mul" || instruction.operands.size() != 3)
+            {
+                reduced.push_back(instruction);
+                continue;
+            }
+
+            auto& ops = instruction.operands;
+            int value;
+            string source;
+            if (is_register(ops[1]) && constant_operand(ops[2], value))
+                source = ops[1];
+            else if (is_register(ops[2]) && constant_operand(ops[1], value))
+                source = ops[2];
+            else
+            {
+                reduced.push_back(instruction);
+                continue;
+            }
+
+            auto sequence = multiply_sequence(body, ops[0], source, value);
+            if (sequence_cost(sequence) < instruction_cost.at("mul"))
+                reduced.insert(reduced.end(), sequence.begin(), sequence.end());
+            else
+                reduced.push_back(instruction);
+        }
+        block.instructions = reduced;
+    }
+}
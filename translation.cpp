@@ -7,10 +7,19 @@ Code GlobalSymbol::LoadAddress(const string& reg)
     return tab + "la " + reg + ", " + name + "\n";
 }
 
+Code FieldSymbol::LoadAddress(const string& reg)
+{
+    if (small_data_offset >= 0)
+        return tab + "addu " + reg + ", $gp, " + std::to_string(small_data_offset) + "\n";
+    return GlobalSymbol::LoadAddress(reg);
+}
+
 Code FieldSymbol::LoadValue(const string& reg)
 {
     if (is_array_type(type))
         return LoadAddress(reg);
+    if (small_data_offset >= 0)
+        return tab + "lw " + reg + ", " + std::to_string(small_data_offset) + "($gp)\n";
     return tab + "lw " + reg + ", " + name + "\n";
 }
 
@@ -18,6 +27,8 @@ Code FieldSymbol::SaveValue(const string& reg)
 {
     if (is_array_type(type))
         throw CompileError(location, ReadableName() + " of type \"" + type->Name() + "\" is not assignable");
+    if (small_data_offset >= 0)
+        return tab + "sw " + reg + ", " + std::to_string(small_data_offset) + "($gp)\n";
     return tab + "sw " + reg + ", " + name + "\n";
 }
 
@@ -25,17 +36,27 @@ Code FieldSymbol::LoadElementValue(const string& index_reg, const string& dest_r
 {
     if (is_array_type(type))
     {
-        auto underlying_type = (is_array_type(type) ?
-            as_array_type(type)->underlying_type : as_pointer_type(type)->underlying_type);
+        auto underlying_type = as_array_type(type)->underlying_type;
 
+        // an array in the small data section is indexed from $gp like one in the stack frame from $sp
         Code code;
-        if (underlying_type->Width() == 1)
-            code = tab + "lb " + dest_reg + ", " + name + "(" + index_reg + ")\n";
+        if (small_data_offset >= 0 && underlying_type->Width() == 1)
+        {
+            code = tab + "addu " + dest_reg + ", $gp, " + index_reg + "\n";
+            code += tab + "lbu " + dest_reg + ", " + std::to_string(small_data_offset) + "(" + dest_reg + ")\n";
+        }
+        else if (small_data_offset >= 0 && underlying_type->Width() == 4)
+        {
+            code = tab + "sll " + dest_reg + ", " + index_reg + ", 2\n";
+            code += tab + "addu " + dest_reg + ", $gp, " + dest_reg + "\n";
+            code += tab + "lw " + dest_reg + ", " + std::to_string(small_data_offset) + "(" + dest_reg + ")\n";
+        }
+        else if (underlying_type->Width() == 1)
+            code = tab + "lbu " + dest_reg + ", " + name + "(" + index_reg + ")\n";
         else if (underlying_type->Width() == 4)
         {
-            code = tab + "mul " + index_reg + ", " + index_reg + ", "
-                + std::to_string(underlying_type->Width()) + "\n";
-            code += tab + "lw " + dest_reg + ", " + name + "(" + index_reg + ")\n";
+            code = tab + "sll " + dest_reg + ", " + index_reg + ", 2\n";
+            code += tab + "lw " + dest_reg + ", " + name + "(" + dest_reg + ")\n";
         }
         else
             throw CompileError(location, "unsupported type width");
@@ -50,16 +71,25 @@ Code FieldSymbol::SaveElementValue(const string& index_reg, const string& source
 {
     if (is_array_type(type))
     {
-        auto underlying_type = (is_array_type(type) ?
-            as_array_type(type)->underlying_type : as_pointer_type(type)->underlying_type);
+        auto underlying_type = as_array_type(type)->underlying_type;
 
         Code code;
-        if (underlying_type->Width() == 1)
+        if (small_data_offset >= 0 && underlying_type->Width() == 1)
+        {
+            code = tab + "addu " + index_reg + ", $gp, " + index_reg + "\n";
+            code += tab + "sb " + source_reg + ", " + std::to_string(small_data_offset) + "(" + index_reg + ")\n";
+        }
+        else if (small_data_offset >= 0 && underlying_type->Width() == 4)
+        {
+            code = tab + "sll " + index_reg + ", " + index_reg + ", 2\n";
+            code += tab + "addu " + index_reg + ", $gp, " + index_reg + "\n";
+            code += tab + "sw " + source_reg + ", " + std::to_string(small_data_offset) + "(" + index_reg + ")\n";
+        }
+        else if (underlying_type->Width() == 1)
             code = tab + "sb " + source_reg + ", " + name + "(" + index_reg + ")\n";
         else if (underlying_type->Width() == 4)
         {
-            code = tab + "mul " + index_reg + ", " + index_reg + ", "
-                + std::to_string(underlying_type->Width()) + "\n";
+            code = tab + "sll " + index_reg + ", " + index_reg + ", 2\n";
             code += tab + "sw " + source_reg + ", " + name + "(" + index_reg + ")\n";
         }
         else
@@ -92,42 +122,21 @@ Code VariableSymbol::LoadAddress(const string& reg)
 
 Code VariableSymbol::LoadElementValue(const string& index_reg, const string& dest_reg)
 {
-    if (is_array_type(type) || is_pointer_type(type))
+    if (is_array_type(type))
     {
-        auto underlying_type = (is_array_type(type) ?
-            as_array_type(type)->underlying_type : as_pointer_type(type)->underlying_type);
+        auto underlying_type = as_array_type(type)->underlying_type;
 
         Code code;
         if (underlying_type->Width() == 1)
         {
-            if (is_array_type(type))
-            {
-                code = tab + "addu " + index_reg + ", $sp, " + index_reg + "\n";
-                code += tab + "lb " + dest_reg + ", " + StackOffset() + "(" + index_reg + ")\n";
-            }
-            else
-            {
-                code = LoadValue("$t0");
-                code += tab + "addu " + index_reg + ", $t0, " + index_reg + "\n";
-                code += tab + "lb " + dest_reg + ", " + "(" + index_reg + ")\n";
-            }
+            code = tab + "addu " + dest_reg + ", $sp, " + index_reg + "\n";
+            code += tab + "lbu " + dest_reg + ", " + StackOffset() + "(" + dest_reg + ")\n";
         }
         else if (underlying_type->Width() == 4)
         {
-            code = tab + "mul " + index_reg + ", " + index_reg + ", "
-                + std::to_string(underlying_type->Width()) + "\n";
-
-            if (is_array_type(type))
-            {
-                code += tab + "addu " + index_reg + ", $sp, " + index_reg + "\n";
-                code += tab + "lw " + dest_reg + ", " + StackOffset() + "(" + index_reg + ")\n";
-            }
-            else
-            {
-                code = LoadValue("$t0");
-                code += tab + "addu " + index_reg + ", $t0, " + index_reg + "\n";
-                code += tab + "lw " + dest_reg + ", " + "(" + index_reg + ")\n";
-            }
+            code = tab + "sll " + dest_reg + ", " + index_reg + ", 2\n";
+            code += tab + "addu " + dest_reg + ", $sp, " + dest_reg + "\n";
+            code += tab + "lw " + dest_reg + ", " + StackOffset() + "(" + dest_reg + ")\n";
         }
         else
             throw CompileError(location, "unsupported type width");
@@ -140,41 +149,89 @@ Code VariableSymbol::LoadElementValue(const string& index_reg, const string& des
 
 Code VariableSymbol::SaveElementValue(const string& index_reg, const string& source_reg)
 {
-    if (is_array_type(type) || is_pointer_type(type))
+    if (is_array_type(type))
+    {
+        auto underlying_type = as_array_type(type)->underlying_type;
+
+        Code code;
+        if (underlying_type->Width() == 1)
+        {
+            code = tab + "addu " + index_reg + ", $sp, " + index_reg + "\n";
+            code += tab + "sb " + source_reg + ", " + StackOffset() + "(" + index_reg + ")\n";
+        }
+        else if (underlying_type->Width() == 4)
+        {
+            code = tab + "sll " + index_reg + ", " + index_reg + ", 2\n";
+            code += tab + "addu " + index_reg + ", $sp, " + index_reg + "\n";
+            code += tab + "sw " + source_reg + ", " + StackOffset() + "(" + index_reg + ")\n";
+        }
+        else
+            throw CompileError(location, "unsupported type width");
+
+        return code;
+    }
+    else
+        throw CompileError(location, ReadableName() + " of type " + type->Name() + " is not indexable");
+}
+
+Code RegisterSymbol::LoadValue(const string& reg)
+{
+    if (reg == this->reg)
+        return Code();
+    return tab + "move " + reg + ", " + this->reg + "\n";
+}
+
+Code RegisterSymbol::SaveValue(const string& reg)
+{
+    if (reg == this->reg)
+        return Code();
+    return tab + "move " + this->reg + ", " + reg + "\n";
+}
+
+Code RegisterSymbol::LoadElementValue(const string& index_reg, const string& dest_reg)
+{
+    if (is_pointer_type(type))
     {
-        auto underlying_type = (is_array_type(type) ?
-            as_array_type(type)->underlying_type : as_pointer_type(type)->underlying_type);
+        auto underlying_type = as_pointer_type(type)->underlying_type;
 
         Code code;
         if (underlying_type->Width() == 1)
         {
-            if (is_array_type(type))
-            {
-                code = tab + "addu " + index_reg + ", $sp, " + index_reg + "\n";
-                code += tab + "sb " + source_reg + ", " + StackOffset() + "(" + index_reg + ")\n";
-            }
-            else
-            {
-                code = LoadValue("$t0");
-                code += tab + "addu " + index_reg + ", $t0, " + index_reg + "\n";
-                code += tab + "sb " + source_reg + ", " + "(" + index_reg + ")\n";
-            }
+            code = tab + "addu " + dest_reg + ", " + reg + ", " + index_reg + "\n";
+            code += tab + "lbu " + dest_reg + ", (" + dest_reg + ")\n";
         }
         else if (underlying_type->Width() == 4)
         {
-            code = tab + "mul " + index_reg + ", " + index_reg + ", "
-                + std::to_string(underlying_type->Width()) + "\n";
-            if (is_array_type(type))
-            {
-                code += tab + "addu " + index_reg + ", $sp, " + index_reg + "\n";
-                code += tab + "sw " + source_reg + ", " + StackOffset() + "(" + index_reg + ")\n";
-            }
-            else
-            {
-                code = LoadValue("$t0");
-                code += tab + "addu " + index_reg + ", $t0, " + index_reg + "\n";
-                code += tab + "sw " + source_reg + ", " + "(" + index_reg + ")\n";
-            }
+            code = tab + "sll " + dest_reg + ", " + index_reg + ", 2\n";
+            code += tab + "addu " + dest_reg + ", " + reg + ", " + dest_reg + "\n";
+            code += tab + "lw " + dest_reg + ", (" + dest_reg + ")\n";
+        }
+        else
+            throw CompileError(location, "unsupported type width");
+
+        return code;
+    }
+    else
+        throw CompileError(location, ReadableName() + " of type " + type->Name() + " is not indexable");
+}
+
+Code RegisterSymbol::SaveElementValue(const string& index_reg, const string& source_reg)
+{
+    if (is_pointer_type(type))
+    {
+        auto underlying_type = as_pointer_type(type)->underlying_type;
+
+        Code code;
+        if (underlying_type->Width() == 1)
+        {
+            code = tab + "addu " + index_reg + ", " + reg + ", " + index_reg + "\n";
+            code += tab + "sb " + source_reg + ", (" + index_reg + ")\n";
+        }
+        else if (underlying_type->Width() == 4)
+        {
+            code = tab + "sll " + index_reg + ", " + index_reg + ", 2\n";
+            code += tab + "addu " + index_reg + ", " + reg + ", " + index_reg + "\n";
+            code += tab + "sw " + source_reg + ", (" + index_reg + ")\n";
         }
         else
             throw CompileError(location, "unsupported type width");
@@ -216,10 +273,7 @@ void FunctionContext::DeclareParameter(const string& name, shared_ptr<SymbolType
     if (std::find_if(symbols.begin(), symbols.end(),
         [&name](auto s) { return s->name == name; }) != symbols.end())
         throw CompileError(loc, "redeclaration of function parameter \"" + name + "\"");
-    symbols.push_back(std::make_shared<VariableSymbol>(name, type, context_depth, stack_depth, loc));
-
-    context_depth += type->AllignedWidth(stack_alignment);
-    UpdateStackDepth();
+    symbols.push_back(std::make_shared<RegisterSymbol>(name, type, NewRegister(), loc));
 }
 
 shared_ptr<Symbol> FunctionContext::operator[](const string& name) const
@@ -246,8 +300,14 @@ void LocalContext::DeclareVariable(const string& name, shared_ptr<SymbolType> ty
         [&name](auto s) { return s->name == name; }) != referenced_symbols.end())
         throw CompileError(loc, "variable \"" + name + "\" is referenced before declaration");
 
-    int stack_offset = CumulativeDepth() +
-        type->AllignedWidth(function_context.stack_alignment) - function_context.stack_alignment;
+    // only arrays need memory, scalars are kept in registers
+    if (!is_array_type(type))
+    {
+        symbols.push_back(std::make_shared<RegisterSymbol>(name, type, function_context.NewRegister(), loc));
+        return;
+    }
+
+    int stack_offset = CumulativeDepth() + type->AllignedWidth(function_context.stack_alignment);
     symbols.push_back(std::make_shared<VariableSymbol>(name, type, stack_offset, function_context.stack_depth, loc));
 
     context_depth += type->AllignedWidth(function_context.stack_alignment);
@@ -260,6 +320,8 @@ shared_ptr<Symbol> LocalContext::operator[](const string& name)
     auto it = std::find_if(symbols.begin(), symbols.end(), [&name](auto s) { return s->name == name; });
     if (it != symbols.end())
         result = *it;
+    else if (!inlined_function.empty())
+        result = global_context[name];
     else if (previous_context != nullptr)
         result = (*previous_context)[name];
     else
@@ -268,16 +330,18 @@ shared_ptr<Symbol> LocalContext::operator[](const string& name)
     return result;
 }
 
-shared_ptr<VariableSymbol> ExpressionContext::NewTemp(shared_ptr<SymbolType> type, const Location& loc)
+shared_ptr<RegisterSymbol> ExpressionContext::NewTemp(shared_ptr<SymbolType> type, const Location& loc)
 {
-    int stack_offset = local_context.CumulativeDepth() + context_depth;
-    auto temp = std::make_shared<VariableSymbol>("", type, stack_offset,
-        local_context.function_context.stack_depth, loc);
+    return std::make_shared<RegisterSymbol>("", type, local_context.function_context.NewRegister(), loc);
+}
 
-    context_depth += local_context.function_context.stack_alignment;
-    local_context.UpdateStackDepth(context_depth);
+std::pair<Code, string> ExpressionContext::ValueRegister(shared_ptr<Symbol> symbol)
+{
+    if (auto reg = std::dynamic_pointer_cast<RegisterSymbol>(symbol))
+        return std::make_pair(Code(), reg->reg);
 
-    return temp;
+    auto temp = NewTemp(symbol->location);
+    return std::make_pair(symbol->LoadValue(temp->reg), temp->reg);
 }
 
 
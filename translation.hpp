@@ -278,7 +278,9 @@ public:
     virtual Code SaveValue(const string& reg) = 0;
     virtual Code LoadAddress(const string& reg) = 0;
     
+    // dest_reg may be used as scratch, index_reg is left untouched
     virtual Code LoadElementValue(const string& index_reg, const string& dest_reg) = 0;
+    // index_reg is used as scratch and does not hold the index afterwards
     virtual Code SaveElementValue(const string& index_reg, const string& source_reg) = 0;
 
 protected:
@@ -304,9 +306,14 @@ public:
 class FieldSymbol : public GlobalSymbol
 {
 public:
-    FieldSymbol(const string& name, shared_ptr<SymbolType> type, const Location& loc)
-        : GlobalSymbol(name, type, loc) {}
-        
+    FieldSymbol(const string& name, shared_ptr<SymbolType> type, const Location& loc, int small_data_offset = -1)
+        : GlobalSymbol(name, type, loc), small_data_offset(small_data_offset) {}
+
+    // where the variable is from $gp when it lives in the small data section, -1 otherwise
+    int small_data_offset;
+
+    virtual Code LoadAddress(const string& reg);
+
     virtual Code LoadValue(const string& reg);
 
     virtual Code SaveValue(const string& reg);
@@ -321,10 +328,13 @@ class FunctionSymbol : public GlobalSymbol
 {
 public:
     FunctionSymbol(const string& name, shared_ptr<SymbolType> type,
-        vector<shared_ptr<SymbolType>> param_types, const Location& loc)
-        : GlobalSymbol(name, type, loc), param_types(param_types) {}
+        vector<shared_ptr<SymbolType>> param_types, const Location& loc, int syscall = -1)
+        : GlobalSymbol(name, type, loc), param_types(param_types), syscall(syscall) {}
 
     vector<shared_ptr<SymbolType>> param_types;
+
+    // the system call a builtin makes, done in place of calling it; -1 for functions called with jal
+    int syscall;
         
     virtual Code LoadValue(const string& reg)
     {
@@ -348,6 +358,7 @@ public:
 };
 
 
+// a symbol living in the stack frame, used for arrays and saved registers
 class VariableSymbol : public Symbol
 {
 public:
@@ -355,7 +366,7 @@ public:
         shared_ptr<int> stack_depth, const Location& loc)
         : Symbol(name, type, loc), offset(offset), stack_depth(stack_depth) {}
 
-    int offset;
+    int offset; // depth of the end of the variable, measured from the top of the frame
     shared_ptr<int> stack_depth;
     
     virtual Code LoadValue(const string& reg);
@@ -378,6 +389,31 @@ private:
 };
 
 
+// a symbol held in a virtual register, used for scalar variables, parameters and temporaries;
+// virtual registers are mapped to machine registers or stack slots by the register allocator
+class RegisterSymbol : public Symbol
+{
+public:
+    RegisterSymbol(const string& name, shared_ptr<SymbolType> type, const string& reg, const Location& loc)
+        : Symbol(name, type, loc), reg(reg) {}
+
+    string reg;
+
+    virtual Code LoadValue(const string& reg);
+
+    virtual Code SaveValue(const string& reg);
+
+    virtual Code LoadAddress(const string& reg)
+    {
+        throw CompileError(location, ReadableName() + " is not addressable");
+    }
+
+    virtual Code LoadElementValue(const string& index_reg, const string& dest_reg);
+
+    virtual Code SaveElementValue(const string& index_reg, const string& source_reg);
+};
+
+
 class VoidSymbol : public Symbol
 {
 public:
@@ -398,11 +434,47 @@ private:
 };
 
 
+// code generation settings given on the command line
+class CompileOptions
+{
+public:
+    // where to write the intermediate representation of every function, nowhere if null
+    std::ostream* ir_output = nullptr;
+
+    // how many instructions an inlined call may add over the call it replaces, negative to never inline
+    int inline_threshold = 16;
+
+    // how many copies of the body of a counted for loop run for each test, 1 or less to never unroll
+    int unroll_factor = 4;
+
+    // how many instructions the copies of an unrolled loop body may take together; loops with a
+    // known trip count fitting in it are unrolled completely
+    int unroll_limit = 64;
+
+    // the pipeline instructions are ordered for, r3000 or r4000 (see PipelineModel), or none to
+    // keep them in the order they are generated in
+    string pipeline = "r3000";
+
+    // the largest global variable, in bytes, placed in the small data section and reached
+    // with a single instruction relative to $gp, 0 to place none there
+    int small_data_limit = 8;
+};
+
+
+class FunctionDefinition;
+
+
 class GlobalContext
 {
 public:
     string current_section = "code";
 
+    // the variables of the small data section, which $gp points to the start of
+    Code small_data;
+    int small_data_size = 0;
+
+    CompileOptions options;
+
     shared_ptr<FieldSymbol> DeclareField(const FieldSymbol& field);
 
     shared_ptr<FunctionSymbol> DeclareFunction(const FunctionSymbol& function);
@@ -418,6 +490,14 @@ public:
     function<void(const Location&, const string&, const string&)> printer;
 
     map<string, shared_ptr<GlobalSymbol>> symbols;
+
+    // functions that may be compiled in place of their calls with their size in instructions;
+    // functions calling themselves are left out
+    map<string, std::pair<FunctionDefinition*, int>> inline_candidates;
+    set<string> recursive_functions;
+
+    // one line for every call that was inlined
+    vector<string> inline_report;
 };
 
 
@@ -426,7 +506,7 @@ class FunctionContext
 public:
     FunctionContext(GlobalContext& global_context, FunctionSymbol& symbol)
         : global_context(global_context), function_symbol(symbol),
-        epilouge_label("$" + symbol.name + "_epilouge") {}
+        start_label("$" + symbol.name + "_start"), epilouge_label("$" + symbol.name + "_epilouge") {}
 
     void DeclareParameter(const string& name, shared_ptr<SymbolType> type, const Location& loc);
 
@@ -437,14 +517,26 @@ public:
         *stack_depth = std::max(*stack_depth, context_depth + depth);
     }
 
+    string NewRegister()
+    {
+        return "%" + std::to_string(++register_count);
+    }
+
     GlobalContext& global_context;
     FunctionSymbol& function_symbol;
 
+    // calls to the function itself in tail position branch to start_label, placed after the
+    // parameters are read from the argument registers when tail_recursive is set
+    string start_label;
+    bool tail_recursive = false;
+
     string epilouge_label;
 
     int context_depth = 0;
     shared_ptr<int> stack_depth = std::make_shared<int>(0);
-    vector<shared_ptr<VariableSymbol>> symbols;
+    vector<shared_ptr<Symbol>> symbols;
+
+    int register_count = 0;
 
     static const int stack_alignment = 4;
 };
@@ -486,9 +578,24 @@ public:
     LocalContext* previous_context;
     FunctionContext& function_context;
     GlobalContext& global_context;
+
+    // set on the context holding the parameters of an inlined function, whose body can't see
+    // the variables of the caller; returns store the value in return_register and branch to return_label
+    string inlined_function, return_label, return_register;
+    shared_ptr<SymbolType> return_type;
+
+    // the innermost inlined function this context is in, null in the body of the function itself
+    LocalContext* InlinedCall()
+    {
+        if (!inlined_function.empty())
+            return this;
+        if (previous_context != nullptr)
+            return previous_context->InlinedCall();
+        return nullptr;
+    }
     
     int context_depth = 0;
-    vector<shared_ptr<VariableSymbol>> symbols;
+    vector<shared_ptr<Symbol>> symbols;
     set<shared_ptr<Symbol>> referenced_symbols;
 
     string break_label;
@@ -496,7 +603,7 @@ public:
     {
         if (!break_label.empty())
             return break_label;
-        if (previous_context != nullptr)
+        if (previous_context != nullptr && inlined_function.empty())
             return previous_context->LastBreakLabel();
         return "";
     }
@@ -506,7 +613,7 @@ public:
     {
         if (!continue_label.empty())
             return continue_label;
-        if (previous_context != nullptr)
+        if (previous_context != nullptr && inlined_function.empty())
             return previous_context->LastContinueLabel();
         return "";
     }
@@ -520,17 +627,18 @@ public:
         : local_context(local_context) {}
         
     ExpressionContext(ExpressionContext& expression_context)
-        : local_context(expression_context.local_context), context_depth(expression_context.context_depth) {}
+        : local_context(expression_context.local_context) {}
 
     LocalContext& local_context;
     
-    shared_ptr<VariableSymbol> NewTemp(const Location& loc)
+    shared_ptr<RegisterSymbol> NewTemp(const Location& loc)
     {
         return NewTemp(std::make_shared<IntType>(), loc);
     }
 
-    shared_ptr<VariableSymbol> NewTemp(shared_ptr<SymbolType> type, const Location& loc);
+    shared_ptr<RegisterSymbol> NewTemp(shared_ptr<SymbolType> type, const Location& loc);
 
-    int context_depth = 0;
+    // returns a register holding the value of symbol, loading it into a new temporary if needed
+    std::pair<Code, string> ValueRegister(shared_ptr<Symbol> symbol);
 };
 